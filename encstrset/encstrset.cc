@@ -1,16 +1,27 @@
 #include "encstrset.h"
 
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
 using identifier_t = unsigned long;
 using value_t = string;
+using cypher_view_t = string_view;
+using hash_t = size_t;
 using debug_message_t = string;
 using value_argument_t = const char *;
 using key_argument_t = const char *;
-using set_t = unordered_set<value_t>;
-using map_t = unordered_map<identifier_t, set_t>;
+using values_argument_t = const char *const *;
+using keys_argument_t = const char *const *;
+using results_argument_t = bool *;
+using ids_argument_t = const identifier_t *;
+using bitmap_argument_t = unsigned char *;
+using path_argument_t = const char *;
+using visitor_argument_t = bool (*)(const char *, size_t, void *);
 
 namespace {
 
@@ -20,274 +31,3542 @@ constexpr bool DEBUG = true;
 constexpr bool DEBUG = false;
 #endif
 
-map_t &map_of_sets() {
-    static map_t map_of_sets;
-    return map_of_sets;
+#ifdef ENCSTRSET_CONCURRENT
+constexpr bool CONCURRENT = true;
+#else
+constexpr bool CONCURRENT = false;
+#endif
+
+// Stands in for the real mutexes when the library is built single-threaded.
+struct null_mutex_t {
+    void lock() {}
+    void unlock() {}
+    void lock_shared() {}
+    void unlock_shared() {}
+};
+
+using set_mutex_t = conditional_t<CONCURRENT, shared_mutex, null_mutex_t>;
+using table_mutex_t = conditional_t<CONCURRENT, mutex, null_mutex_t>;
+using read_lock_t = shared_lock<set_mutex_t>;
+using write_lock_t = unique_lock<set_mutex_t>;
+
+// Where a set takes the memory for its slots and cypher bytes from. Null
+// hooks stand for calloc() and free().
+struct allocator_hooks_t {
+    void *(*allocate)(size_t size, void *context) = nullptr;
+    void (*release)(void *memory, size_t size, void *context) = nullptr;
+    void *context = nullptr;
+
+    bool operator==(const allocator_hooks_t &other) const {
+        return allocate == other.allocate and release == other.release and
+               context == other.context;
+    }
+
+    bool operator!=(const allocator_hooks_t &other) const {
+        return not (*this == other);
+    }
+};
+
+// Hands out zeroed memory through the hooks it was created with, which
+// travel with the container, so every buffer is released by the hooks that
+// allocated it. Value-initialized elements are left as they come, so a
+// large vector of all-zero structures costs no extra pass over its memory;
+// calloc() gets it from the kernel zeroed page by page.
+template<typename T>
+class storage_allocator_t {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = true_type;
+    using propagate_on_container_move_assignment = true_type;
+    using propagate_on_container_swap = true_type;
+
+    storage_allocator_t() = default;
+
+    explicit storage_allocator_t(const allocator_hooks_t &hooks)
+            : _hooks(hooks) {}
+
+    template<typename U>
+    storage_allocator_t(const storage_allocator_t<U> &other)
+            : _hooks(other.hooks()) {}
+
+    const allocator_hooks_t &hooks() const { return _hooks; }
+
+    T *allocate(size_t n) {
+        void *memory;
+        if (_hooks.allocate) {
+            memory = _hooks.allocate(n * sizeof(T), _hooks.context);
+            if (memory)
+                memset(memory, 0, n * sizeof(T));
+        }
+        else {
+            memory = calloc(n, sizeof(T));
+        }
+
+        if (!memory)
+            throw bad_alloc();
+
+        return static_cast<T *>(memory);
+    }
+
+    void deallocate(T *memory, size_t n) {
+        if (_hooks.release)
+            _hooks.release(memory, n * sizeof(T), _hooks.context);
+        else
+            free(memory);
+    }
+
+    template<typename U>
+    void construct(U *) {}
+
+    template<typename U, typename... Args>
+    void construct(U *memory, Args &&...args) {
+        ::new (static_cast<void *>(memory)) U(forward<Args>(args)...);
+    }
+
+    template<typename U>
+    bool operator==(const storage_allocator_t<U> &other) const {
+        return _hooks == other.hooks();
+    }
+
+    template<typename U>
+    bool operator!=(const storage_allocator_t<U> &other) const {
+        return _hooks != other.hooks();
+    }
+
+private:
+    allocator_hooks_t _hooks;
+};
+
+// Open-addressing set of cyphers. The table keeps only hashes and
+// (offset, length) pairs, the cypher bytes are appended to a per-set arena,
+// so a set owns exactly two buffers no matter how many elements it holds.
+//
+// Lookups go through plain pointers to the slots and the bytes, which point
+// either into the owned buffers or into a mapped snapshot file. A mapped
+// table is read-only; copying it yields an owned one.
+//
+// Growing does not rehash in one go: the old slots are set aside as pending
+// and every later insert or erase moves MIGRATION_STEP of them, in index
+// order, into the new table. Until they are all moved, lookups also probe
+// the pending slots at or past the migration position.
+//
+// The arena moves along with the slots: the old one is kept next to a new
+// one until the last pending slot has taken its bytes across. The same
+// migration, with a table of the same size, compacts the arena once erased
+// cyphers take up half of it, and relocates an arena that is full. Inserts
+// and erases that move slots report their hashes to an optional observer.
+class cypher_table {
+public:
+    struct slot_t {
+        hash_t hash;
+        size_t offset;
+        size_t length;
+    };
+
+    // Observer for callers that do not follow the moves of slots.
+    struct ignore_moves_t {
+        void operator()(hash_t) const {}
+    };
+
+    // The snapshot file is this header, then the slots, then the bytes.
+    struct snapshot_header_t {
+        array<char, 8> magic;
+        uint64_t slot_size;
+        uint64_t hash_check;
+        uint64_t size;
+        uint64_t slot_count;
+        uint64_t arena_size;
+    };
+
+    static constexpr array<char, 8> SNAPSHOT_MAGIC{'E', 'N', 'C', 'S',
+                                                   'E', 'T', '0', '1'};
+
+    explicit cypher_table(const allocator_hooks_t &hooks = {})
+            : _table(slot_allocator_t(hooks)),
+              _pending(slot_allocator_t(hooks)),
+              _arena(byte_allocator_t(hooks)),
+              _old_arena(byte_allocator_t(hooks)) {}
+
+    // The copy has no pending slots, it takes them over straight away,
+    // along with their bytes when other is relocating its arena.
+    cypher_table(const cypher_table &other, const allocator_hooks_t &hooks = {})
+            : _table(other._slots, other._slots + other._slot_count,
+                     slot_allocator_t(hooks)),
+              _pending(slot_allocator_t(hooks)),
+              _arena(other._bytes, other._bytes + other._byte_count,
+                     byte_allocator_t(hooks)),
+              _old_arena(byte_allocator_t(hooks)),
+              _size(other._size),
+              _dead_bytes(other._dead_bytes) {
+        refresh_views();
+        for (size_t i = other._migrated; i < other._pending.size(); i++) {
+            slot_t slot = other._pending[i];
+            if (not live(slot))
+                continue;
+
+            if (other.relocating()) {
+                auto cypher = other.pending_cypher_at(slot);
+                slot.offset = _arena.size();
+                _arena.insert(_arena.end(), cypher.begin(), cypher.end());
+            }
+            place(slot);
+        }
+        refresh_views();
+    }
+
+    cypher_table &operator=(const cypher_table &other) = delete;
+
+    // Wraps a snapshot mapped into memory. keep_alive owns the mapping.
+    cypher_table(const snapshot_header_t &header, const char *data,
+                 shared_ptr<const void> keep_alive)
+            : _mapping(move(keep_alive)),
+              _slots(reinterpret_cast<const slot_t *>(data)),
+              _slot_count(header.slot_count),
+              _bytes(data + header.slot_count * sizeof(slot_t)),
+              _byte_count(header.arena_size),
+              _size(header.size) {}
+
+    size_t size() const { return _size; }
+
+    bool mapped() const { return _mapping != nullptr; }
+
+    allocator_hooks_t hooks() const { return _arena.get_allocator().hooks(); }
+
+    // Bytes held for the slots and for the cypher bytes, counting spare
+    // capacity and the bytes of erased cyphers not yet compacted away.
+    size_t slot_bytes() const {
+        if (mapped())
+            return _slot_count * sizeof(slot_t);
+
+        return (_table.capacity() + _pending.capacity()) * sizeof(slot_t);
+    }
+
+    size_t payload_bytes() const {
+        return mapped() ? _byte_count
+                        : _arena.capacity() + _old_arena.capacity();
+    }
+
+    static hash_t hash_of(cypher_view_t cypher) {
+        hash_t hash = std::hash<cypher_view_t>{}(cypher);
+        return hash == EMPTY ? 1 : hash;
+    }
+
+    bool contains(cypher_view_t cypher) const {
+        return contains(cypher, hash_of(cypher));
+    }
+
+    bool contains(cypher_view_t cypher, hash_t hash) const {
+        return find_slot(cypher, hash) != NOT_FOUND or
+               find_pending(cypher, hash) != NOT_FOUND;
+    }
+
+    bool insert(cypher_view_t cypher) {
+        return insert(cypher, hash_of(cypher));
+    }
+
+    // moved is called with the hash of every slot that changes its place,
+    // other than the inserted one.
+    template<typename Observer = ignore_moves_t>
+    bool insert(cypher_view_t cypher, hash_t hash, Observer moved = {}) {
+        assert(not mapped());
+        if (contains(cypher, hash))
+            return false;
+
+        if ((_size + 1) * 2 > _table.size()) {
+            migrate(_pending.size(), moved);
+            start_migration(2 * (live_bytes() + cypher.size()));
+        }
+
+        // Nothing is placed before the bytes are in, so running out of
+        // memory leaves the table as it was.
+        make_room(cypher.size());
+        size_t offset = _arena.size();
+        _arena.insert(_arena.end(), cypher.begin(), cypher.end());
+        place({hash, offset, cypher.size()});
+        _size++;
+        migrate(MIGRATION_STEP, moved);
+        refresh_views();
+
+        return true;
+    }
+
+    bool erase(cypher_view_t cypher) {
+        return erase(cypher, hash_of(cypher));
+    }
+
+    template<typename Observer = ignore_moves_t>
+    bool erase(cypher_view_t cypher, hash_t hash, Observer moved = {}) {
+        assert(not mapped());
+        size_t hole = find_slot(cypher, hash);
+        size_t pending = hole == NOT_FOUND ? find_pending(cypher, hash)
+                                           : NOT_FOUND;
+        if (hole == NOT_FOUND and pending == NOT_FOUND)
+            return false;
+
+        if (hole != NOT_FOUND) {
+            _dead_bytes += _table[hole].length;
+            remove_slot(hole, moved);
+        }
+        else {
+            // Pending slots keep their probe sequences until they are all
+            // moved, so an erased one is only marked. Its bytes stay behind
+            // in the old arena if there is one.
+            if (relocating())
+                _unmoved_bytes -= _pending[pending].length;
+            else
+                _dead_bytes += _pending[pending].length;
+            _pending[pending].offset = ERASED;
+        }
+        _size--;
+        migrate(MIGRATION_STEP, moved);
+
+        if (_pending.empty() and _dead_bytes > _arena.size() / 2) {
+            try {
+                start_migration(2 * live_bytes());
+            }
+            catch (const bad_alloc &) {
+                // Compaction only saves memory, so it is skipped when there
+                // is none to spare for the new arena.
+            }
+        }
+        refresh_views();
+
+        return true;
+    }
+
+    // Brings the home slot of hash into cache ahead of a lookup.
+    void prefetch(hash_t hash) const {
+        if (_slot_count > 0)
+            __builtin_prefetch(&_slots[hash & mask()]);
+    }
+
+    // Grows the table so that n elements fit without rehashing. This is
+    // the one place where the whole table is rehashed at once.
+    void reserve(size_t n) {
+        assert(not mapped());
+        size_t capacity = max(MIN_CAPACITY, _table.size());
+        while (n * 2 > capacity)
+            capacity *= 2;
+
+        if (capacity > _table.size()) {
+            migrate(_pending.size());
+            grow_to(capacity);
+        }
+    }
+
+    void clear() {
+        assert(not mapped());
+        _table = slots_t(_table.get_allocator());
+        _pending = slots_t(_pending.get_allocator());
+        _migrated = 0;
+        _arena = arena_t(_arena.get_allocator());
+        _old_arena = arena_t(_old_arena.get_allocator());
+        _size = 0;
+        _dead_bytes = 0;
+        _unmoved_bytes = 0;
+        refresh_views();
+    }
+
+    // Slots of the table followed by the pending ones, see for_each_in().
+    size_t slot_count() const { return _slot_count + _pending.size(); }
+
+    template<typename Visitor>
+    void for_each(Visitor visit) const {
+        for_each_in(0, slot_count(), [&](cypher_view_t cypher, hash_t) {
+            visit(cypher);
+        });
+    }
+
+    // Visits the cyphers, with their hashes, stored in slots [first, last).
+    // Positions past the table refer to the pending slots.
+    template<typename Visitor>
+    void for_each_in(size_t first, size_t last, Visitor visit) const {
+        for (size_t i = first; i < min(last, _slot_count); i++)
+            if (_slots[i].hash != EMPTY)
+                visit(cypher_at(_slots[i]), _slots[i].hash);
+
+        for (size_t i = max(first, _slot_count); i < last; i++) {
+            const auto &slot = _pending[i - _slot_count];
+            if (i - _slot_count >= _migrated and live(slot))
+                visit(pending_cypher_at(slot), slot.hash);
+        }
+    }
+
+    // Steps a cursor: finds the first cypher stored at or past position, in
+    // the order of for_each_in(), and moves position past it.
+    bool next(size_t &position, cypher_view_t &cypher) const {
+        for (; position < _slot_count; position++) {
+            if (_slots[position].hash != EMPTY) {
+                cypher = cypher_at(_slots[position++]);
+                return true;
+            }
+        }
+
+        for (; position < slot_count(); position++) {
+            const auto &slot = _pending[position - _slot_count];
+            if (position - _slot_count >= _migrated and live(slot)) {
+                cypher = pending_cypher_at(slot);
+                position++;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Whether the slots of a snapshot with this header, at data, can be
+    // read safely: every cypher lies within the arena, and exactly size
+    // slots are taken, fewer than there are, so every probe sequence ends
+    // at an empty one.
+    static bool valid_slots(const snapshot_header_t &header,
+                            const char *data) {
+        auto slots = reinterpret_cast<const slot_t *>(data);
+        uint64_t taken = 0;
+
+        for (uint64_t i = 0; i < header.slot_count; i++) {
+            const slot_t &slot = slots[i];
+            if (slot.hash == EMPTY)
+                continue;
+            if (slot.offset > header.arena_size or
+                slot.length > header.arena_size - slot.offset)
+                return false;
+            taken++;
+        }
+
+        return taken == header.size and
+               (header.slot_count == 0 or taken < header.slot_count);
+    }
+
+    static uint64_t snapshot_hash_check() {
+        return hash_of("encstrset snapshot");
+    }
+
+    // The slots and bytes are written as they are: offsets are relative to
+    // the arena, so the layout does not depend on where it is mapped.
+    void write_snapshot(ostream &stream) const {
+        if (not _pending.empty())
+            return cypher_table(*this).write_snapshot(stream);
+
+        snapshot_header_t header{SNAPSHOT_MAGIC, sizeof(slot_t),
+                                 snapshot_hash_check(), _size, _slot_count,
+                                 _byte_count};
+
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char *>(_slots),
+                     _slot_count * sizeof(slot_t));
+        stream.write(_bytes, _byte_count);
+    }
+
+private:
+    static constexpr hash_t EMPTY = 0;
+    static constexpr size_t NOT_FOUND = numeric_limits<size_t>::max();
+    static constexpr size_t MIN_CAPACITY = 8;
+    static constexpr size_t MIGRATION_STEP = 8;
+    // Offset marking an erased pending slot.
+    static constexpr size_t ERASED = numeric_limits<size_t>::max();
+
+    using slot_allocator_t = storage_allocator_t<slot_t>;
+    using byte_allocator_t = storage_allocator_t<char>;
+    using slots_t = vector<slot_t, slot_allocator_t>;
+    using arena_t = vector<char, byte_allocator_t>;
+
+    slots_t _table;
+    slots_t _pending;
+    size_t _migrated = 0;
+    arena_t _arena;
+    // Arena the pending slots point into while the arena is relocated.
+    arena_t _old_arena;
+    shared_ptr<const void> _mapping;
+    const slot_t *_slots = nullptr;
+    size_t _slot_count = 0;
+    const char *_bytes = nullptr;
+    size_t _byte_count = 0;
+    size_t _size = 0;
+    size_t _dead_bytes = 0;
+    // Bytes of the live pending cyphers still in the old arena.
+    size_t _unmoved_bytes = 0;
+
+    void refresh_views() {
+        _slots = _table.data();
+        _slot_count = _table.size();
+        _bytes = _arena.data();
+        _byte_count = _arena.size();
+    }
+
+    size_t mask() const { return _slot_count - 1; }
+
+    cypher_view_t cypher_at(const slot_t &slot) const {
+        return {_bytes + slot.offset, slot.length};
+    }
+
+    bool relocating() const { return not _old_arena.empty(); }
+
+    cypher_view_t pending_cypher_at(const slot_t &slot) const {
+        const char *bytes = relocating() ? _old_arena.data() : _bytes;
+        return {bytes + slot.offset, slot.length};
+    }
+
+    size_t live_bytes() const {
+        return _arena.size() - _dead_bytes + _unmoved_bytes;
+    }
+
+    // Makes room in the arena for count more bytes, and for the pending
+    // cyphers still to be copied in, so that migrate() never reallocates,
+    // nor fails, halfway through an erase. A full arena is relocated by a
+    // migration rather than copied in one go, unless one is under way.
+    void make_room(size_t count) {
+        size_t needed = _arena.size() + count + _unmoved_bytes;
+        if (needed <= _arena.capacity())
+            return;
+
+        if (_pending.empty())
+            start_migration(2 * (live_bytes() + count));
+        else
+            _arena.reserve(max(needed, _arena.capacity() * 2));
+    }
+
+    size_t find_slot(cypher_view_t cypher, hash_t hash) const {
+        if (_slot_count == 0)
+            return NOT_FOUND;
+
+        for (size_t i = hash & mask(); _slots[i].hash != EMPTY;
+             i = (i + 1) & mask())
+            if (_slots[i].hash == hash and cypher_at(_slots[i]) == cypher)
+                return i;
+
+        return NOT_FOUND;
+    }
+
+    static bool live(const slot_t &slot) {
+        return slot.hash != EMPTY and slot.offset != ERASED;
+    }
+
+    // A pending slot before the migration position is stale: its cypher
+    // has been moved to the table, and possibly erased there since.
+    size_t find_pending(cypher_view_t cypher, hash_t hash) const {
+        if (_pending.empty())
+            return NOT_FOUND;
+
+        size_t pending_mask = _pending.size() - 1;
+        for (size_t i = hash & pending_mask; _pending[i].hash != EMPTY;
+             i = (i + 1) & pending_mask)
+            if (_pending[i].hash == hash and live(_pending[i]) and
+                pending_cypher_at(_pending[i]) == cypher)
+                return i < _migrated ? NOT_FOUND : i;
+
+        return NOT_FOUND;
+    }
+
+    void place(const slot_t &slot) {
+        size_t i = slot.hash & mask();
+        while (_table[i].hash != EMPTY)
+            i = (i + 1) & mask();
+        _table[i] = slot;
+    }
+
+    // Backward-shift deletion keeps probe sequences intact without leaving
+    // tombstones behind.
+    template<typename Observer>
+    void remove_slot(size_t hole, Observer moved) {
+        for (size_t i = (hole + 1) & mask(); _table[i].hash != EMPTY;
+             i = (i + 1) & mask()) {
+            size_t home = _table[i].hash & mask();
+            if (((i - home) & mask()) >= ((i - hole) & mask())) {
+                _table[hole] = _table[i];
+                moved(_table[hole].hash);
+                hole = i;
+            }
+        }
+        _table[hole] = slot_t{};
+    }
+
+    // Sets the slots aside as pending and the arena aside as the old one,
+    // and starts an empty table and an arena with room for the given number
+    // of bytes. The table gets enough slots that the inserts made until
+    // every pending slot has moved cannot fill it. Running out of memory
+    // leaves everything as it was.
+    void start_migration(size_t bytes) {
+        assert(_pending.empty());
+        size_t capacity = max(MIN_CAPACITY, _table.size());
+        while ((_size + _table.size() / MIGRATION_STEP + 1) * 2 > capacity)
+            capacity *= 2;
+
+        slots_t table(capacity, _table.get_allocator());
+        arena_t arena(_arena.get_allocator());
+        arena.reserve(bytes);
+
+        _unmoved_bytes = live_bytes();
+        _pending.swap(_table);
+        _table.swap(table);
+        _migrated = 0;
+        _old_arena.swap(_arena);
+        _arena.swap(arena);
+        _dead_bytes = 0;
+        refresh_views();
+    }
+
+    // Moves up to steps pending slots to the table, copying their bytes
+    // out of the old arena if there is one.
+    template<typename Observer = ignore_moves_t>
+    void migrate(size_t steps, Observer moved = {}) {
+        if (_pending.empty())
+            return;
+
+        size_t last = min(_pending.size(), _migrated + steps);
+        for (; _migrated < last; _migrated++) {
+            slot_t slot = _pending[_migrated];
+            if (not live(slot))
+                continue;
+
+            if (relocating()) {
+                auto cypher = pending_cypher_at(slot);
+                slot.offset = _arena.size();
+                _arena.insert(_arena.end(), cypher.begin(), cypher.end());
+                _unmoved_bytes -= slot.length;
+            }
+            place(slot);
+            moved(slot.hash);
+        }
+
+        if (_migrated == _pending.size()) {
+            _pending = slots_t(_pending.get_allocator());
+            _migrated = 0;
+            _old_arena = arena_t(_old_arena.get_allocator());
+        }
+    }
+
+    void grow_to(size_t capacity) {
+        slots_t old_table(capacity, _table.get_allocator());
+        _table.swap(old_table);
+        refresh_views();
+
+        for (const auto &slot : old_table)
+            if (slot.hash != EMPTY)
+                place(slot);
+    }
+};
+
+// Blocked Bloom filter. A hash selects one cache-line-sized block and sets
+// BLOOM_PROBES bits inside it, so a negative answer costs one cache miss.
+// Bits cannot be cleared, so removals only make the filter stale; a stale
+// filter is bypassed until the owning set has rebuilt a fresh one.
+class bloom_filter {
+public:
+    explicit bloom_filter(size_t expected_elements) {
+        reset(expected_elements);
+    }
+
+    void reset(size_t expected_elements) {
+        size_t bits = max<size_t>(expected_elements, 1) * BITS_PER_ELEMENT;
+        _blocks.assign((bits + BLOCK_BITS - 1) / BLOCK_BITS, block_t{});
+        _removals = 0;
+        _stale = false;
+    }
+
+    void add(hash_t hash) {
+        auto &block = block_of(hash);
+        for (size_t probe = 0; probe < BLOOM_PROBES; probe++) {
+            auto bit = bit_of(hash, probe);
+            block.words[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+    }
+
+    bool may_contain(hash_t hash) const {
+        const auto &block = block_of(hash);
+        for (size_t probe = 0; probe < BLOOM_PROBES; probe++) {
+            auto bit = bit_of(hash, probe);
+            if (not (block.words[bit / 64] & (uint64_t(1) << (bit % 64))))
+                return false;
+        }
+
+        return true;
+    }
+
+    void prefetch(hash_t hash) const { __builtin_prefetch(&block_of(hash)); }
+
+    bool stale() const { return _stale; }
+
+    size_t memory_usage() const {
+        return sizeof(*this) + _blocks.capacity() * sizeof(block_t);
+    }
+
+    void mark_stale() { _stale = true; }
+
+    // Called after every successful insertion or removal. The filter goes
+    // stale once it is overfilled or once removals make up half of the set.
+    void note_insertion(size_t elements) {
+        if (elements > 2 * capacity())
+            _stale = true;
+    }
+
+    void note_removal(size_t elements) {
+        if (++_removals > elements / 2)
+            _stale = true;
+    }
+
+    void copy_bits(const bloom_filter &other) {
+        _blocks = other._blocks;
+        _removals = other._removals;
+        _stale = other._stale;
+    }
+
+    // Like copy_bits(), in constant time. The counters of lookups stay.
+    void take_bits(bloom_filter &other) {
+        _blocks.swap(other._blocks);
+        _removals = other._removals;
+        _stale = other._stale;
+    }
+
+    void count_rejection() const {
+        _rejections.fetch_add(1, memory_order_relaxed);
+    }
+
+    void count_false_positive() const {
+        _false_positives.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Share of lookups for absent cyphers which the filter let through.
+    double observed_false_positive_rate() const {
+        double false_positives = _false_positives.load(memory_order_relaxed);
+        double rejections = _rejections.load(memory_order_relaxed);
+
+        return false_positives + rejections > 0
+                   ? false_positives / (false_positives + rejections)
+                   : 0;
+    }
+
+    // Rate predicted from how many bits are set.
+    double expected_false_positive_rate() const {
+        size_t set_bits = 0;
+        for (const auto &block : _blocks)
+            for (auto word : block.words)
+                set_bits += __builtin_popcountll(word);
+
+        double fill = double(set_bits) / (_blocks.size() * BLOCK_BITS);
+        return pow(fill, BLOOM_PROBES);
+    }
+
+private:
+    static constexpr size_t BLOCK_BITS = 512;
+    static constexpr size_t BITS_PER_ELEMENT = 10;
+    static constexpr size_t BLOOM_PROBES = 6;
+
+    struct alignas(64) block_t {
+        uint64_t words[BLOCK_BITS / 64];
+    };
+
+    vector<block_t> _blocks;
+    size_t _removals = 0;
+    bool _stale = false;
+    mutable atomic<size_t> _rejections{0};
+    mutable atomic<size_t> _false_positives{0};
+
+    size_t capacity() const {
+        return _blocks.size() * BLOCK_BITS / BITS_PER_ELEMENT;
+    }
+
+    // The table indexes slots with the low bits of the hash, so the filter
+    // mixes the hash before using it.
+    const block_t &block_of(hash_t hash) const {
+        uint64_t mixed = (uint64_t(hash) * 0x9E3779B97F4A7C15ULL) >> 32;
+        return _blocks[(mixed * _blocks.size()) >> 32];
+    }
+
+    block_t &block_of(hash_t hash) {
+        return const_cast<block_t &>(as_const(*this).block_of(hash));
+    }
+
+    static size_t bit_of(hash_t hash, size_t probe) {
+        uint64_t mixed = uint64_t(hash) * 0xC2B2AE3D27D4EB4FULL;
+        return (mixed >> (probe * 9)) % BLOCK_BITS;
+    }
+};
+
+// B+tree of cyphers kept by ordered sets next to their table. Leaves hold
+// up to NODE_SIZE sorted cyphers and are linked both ways, so a prefix scan
+// is one descent followed by a walk along the leaves. Erasing never merges
+// nodes, it only drops the ones it leaves empty; separators may then name
+// erased cyphers, which still bound the keys on either side.
+class cypher_tree {
+public:
+    cypher_tree() = default;
+
+    // Copies every node. The leaves are linked anew, in order.
+    cypher_tree(const cypher_tree &other) {
+        node_t *last_leaf = nullptr;
+        if (other._root)
+            _root = copy_of(*other._root, last_leaf);
+    }
+
+    void insert(cypher_view_t cypher) {
+        if (not _root)
+            _root = make_unique<node_t>(true);
+
+        auto split = insert_into(*_root, cypher);
+        if (split.second) {
+            auto root = make_unique<node_t>(false);
+            root->keys.push_back(move(split.first));
+            root->children.push_back(move(_root));
+            root->children.push_back(move(split.second));
+            _root = move(root);
+        }
+    }
+
+    void erase(cypher_view_t cypher) {
+        if (_root and erase_from(*_root, cypher))
+            _root.reset();
+
+        while (_root and not _root->leaf and _root->children.size() == 1)
+            _root = move(_root->children.front());
+    }
+
+    void clear() { _root.reset(); }
+
+    // Visits the cyphers starting with prefix in order, until visit returns
+    // false. Returns the number of cyphers visited.
+    template<typename Visitor>
+    size_t scan_prefix(cypher_view_t prefix, Visitor visit) const {
+        if (not _root)
+            return 0;
+
+        const node_t *node = _root.get();
+        while (not node->leaf) {
+            auto child = upper_bound(node->keys.begin(), node->keys.end(),
+                                     prefix, less<>()) - node->keys.begin();
+            node = node->children[child].get();
+        }
+
+        size_t visited = 0;
+        auto key = lower_bound(node->keys.begin(), node->keys.end(), prefix,
+                               less<>());
+        while (node) {
+            for (; key != node->keys.end(); key++) {
+                if (cypher_view_t(*key).substr(0, prefix.size()) != prefix)
+                    return visited;
+
+                visited++;
+                if (not visit(cypher_view_t(*key)))
+                    return visited;
+            }
+
+            node = node->next;
+            if (node)
+                key = node->keys.begin();
+        }
+
+        return visited;
+    }
+
+    size_t memory_usage() const {
+        return sizeof(*this) + (_root ? memory_usage(*_root) : 0);
+    }
+
+private:
+    static constexpr size_t NODE_SIZE = 64;
+
+    // In an inner node, keys[i] is a lower bound of children[i + 1] and an
+    // upper bound (exclusive) of children[i].
+    struct node_t {
+        explicit node_t(bool is_leaf) : leaf(is_leaf) {}
+
+        bool leaf;
+        vector<value_t> keys;
+        vector<unique_ptr<node_t>> children;
+        node_t *prev = nullptr;
+        node_t *next = nullptr;
+    };
+
+    unique_ptr<node_t> _root;
+
+    using split_t = pair<value_t, unique_ptr<node_t>>;
+
+    // last_leaf is the copy of the leaf before node, if any.
+    static unique_ptr<node_t> copy_of(const node_t &node,
+                                      node_t *&last_leaf) {
+        auto copy = make_unique<node_t>(node.leaf);
+        copy->keys = node.keys;
+        if (node.leaf) {
+            copy->prev = last_leaf;
+            if (last_leaf)
+                last_leaf->next = copy.get();
+            last_leaf = copy.get();
+        }
+
+        copy->children.reserve(node.children.size());
+        for (const auto &child : node.children)
+            copy->children.push_back(copy_of(*child, last_leaf));
+
+        return copy;
+    }
+
+    // Returns the separator and the new right sibling when node splits.
+    static split_t insert_into(node_t &node, cypher_view_t cypher) {
+        if (node.leaf) {
+            auto key = lower_bound(node.keys.begin(), node.keys.end(), cypher,
+                                   less<>());
+            node.keys.emplace(key, cypher);
+            if (node.keys.size() <= NODE_SIZE)
+                return {};
+
+            auto right = make_unique<node_t>(true);
+            move(node.keys.begin() + NODE_SIZE / 2, node.keys.end(),
+                 back_inserter(right->keys));
+            node.keys.resize(NODE_SIZE / 2);
+
+            right->prev = &node;
+            right->next = node.next;
+            if (node.next)
+                node.next->prev = right.get();
+            node.next = right.get();
+
+            return {right->keys.front(), move(right)};
+        }
+
+        auto child = upper_bound(node.keys.begin(), node.keys.end(), cypher,
+                                 less<>()) - node.keys.begin();
+        auto split = insert_into(*node.children[child], cypher);
+        if (not split.second)
+            return {};
+
+        node.keys.insert(node.keys.begin() + child, move(split.first));
+        node.children.insert(node.children.begin() + child + 1,
+                             move(split.second));
+        if (node.children.size() <= NODE_SIZE)
+            return {};
+
+        auto right = make_unique<node_t>(false);
+        size_t middle = node.keys.size() / 2;
+        value_t separator = move(node.keys[middle]);
+        move(node.keys.begin() + middle + 1, node.keys.end(),
+             back_inserter(right->keys));
+        move(node.children.begin() + middle + 1, node.children.end(),
+             back_inserter(right->children));
+        node.keys.resize(middle);
+        node.children.resize(middle + 1);
+
+        return {move(separator), move(right)};
+    }
+
+    // Returns whether node is left empty.
+    static bool erase_from(node_t &node, cypher_view_t cypher) {
+        if (node.leaf) {
+            auto key = lower_bound(node.keys.begin(), node.keys.end(), cypher,
+                                   less<>());
+            if (key != node.keys.end() and *key == cypher)
+                node.keys.erase(key);
+
+            if (not node.keys.empty())
+                return false;
+
+            if (node.prev)
+                node.prev->next = node.next;
+            if (node.next)
+                node.next->prev = node.prev;
+            return true;
+        }
+
+        auto child = upper_bound(node.keys.begin(), node.keys.end(), cypher,
+                                 less<>()) - node.keys.begin();
+        if (erase_from(*node.children[child], cypher)) {
+            node.children.erase(node.children.begin() + child);
+            if (not node.keys.empty())
+                node.keys.erase(node.keys.begin() + (child > 0 ? child - 1
+                                                               : 0));
+        }
+
+        return node.children.empty();
+    }
+
+    static size_t memory_usage(const node_t &node) {
+        size_t bytes = sizeof(node) + node.keys.capacity() * sizeof(value_t) +
+                       node.children.capacity() * sizeof(node.children[0]);
+        for (const auto &key : node.keys)
+            if (key.capacity() > value_t().capacity())
+                bytes += key.capacity() + 1;
+        for (const auto &child : node.children)
+            bytes += memory_usage(*child);
+
+        return bytes;
+    }
+};
+
+// Frozen form of a set, for large sets that are queried far more often than
+// changed. The cyphers are sorted and front-coded in blocks of BLOCK_SIZE:
+// each one is stored as the length of the prefix it shares with the one
+// before it in the block, then the rest of its bytes, with both lengths as
+// varints. A hash index maps every cypher to its block through a 32-bit
+// fingerprint of its hash, so a lookup probes the index and decodes one
+// block, comparing as it goes instead of rebuilding the cyphers. The index
+// is not a power of two in size, which keeps its load at 4/5: the home
+// slot comes from the upper bits of the hash by a multiply and shift, and
+// the fingerprint from the lower ones.
+//
+// Views handed to visitors point into a decoding buffer and are only valid
+// during the call.
+class compact_table {
+public:
+    // The cyphers must be sorted and distinct.
+    explicit compact_table(const vector<cypher_view_t> &cyphers)
+            : _size(cyphers.size()) {
+        _index.assign(max(MIN_CAPACITY, _size * 5 / 4 + 1), EMPTY);
+        _blocks.reserve((_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+        for (size_t i = 0; i < _size; i++) {
+            size_t shared = 0;
+            if (i % BLOCK_SIZE == 0)
+                _blocks.push_back(_bytes.size());
+            else
+                shared = common_prefix(cyphers[i - 1], cyphers[i]);
+
+            append_varint(shared);
+            append_varint(cyphers[i].size() - shared);
+            _bytes.insert(_bytes.end(), cyphers[i].begin() + shared,
+                          cyphers[i].end());
+            place(cypher_table::hash_of(cyphers[i]), _blocks.size() - 1);
+        }
+        _bytes.shrink_to_fit();
+    }
+
+    size_t size() const { return _size; }
+
+    size_t index_bytes() const {
+        return _index.capacity() * sizeof(_index[0]) +
+               _blocks.capacity() * sizeof(_blocks[0]);
+    }
+
+    size_t payload_bytes() const { return _bytes.capacity(); }
+
+    bool contains(cypher_view_t cypher, hash_t hash) const {
+        uint64_t fingerprint = fingerprint_of(hash);
+        for (size_t i = home(hash); _index[i] != EMPTY; i = next(i))
+            if (_index[i] >> BLOCK_BITS == fingerprint and
+                block_contains(_index[i] & BLOCK_MASK, cypher))
+                return true;
+
+        return false;
+    }
+
+    void prefetch(hash_t hash) const {
+        __builtin_prefetch(&_index[home(hash)]);
+    }
+
+    // Blocks play the part of slots in for_each_in().
+    size_t block_count() const { return _blocks.size(); }
+
+    template<typename Visitor>
+    void for_each(Visitor visit) const {
+        for_each_in(0, block_count(), [&](cypher_view_t cypher, hash_t) {
+            visit(cypher);
+        });
+    }
+
+    // Visits the cyphers, in order and with their hashes, stored in blocks
+    // [first, last).
+    template<typename Visitor>
+    void for_each_in(size_t first, size_t last, Visitor visit) const {
+        value_t cypher;
+        for (size_t block = first; block < last; block++) {
+            for_each_entry(block, [&](size_t shared, cypher_view_t rest) {
+                cypher.resize(shared);
+                cypher.append(rest);
+                visit(cypher_view_t(cypher),
+                      cypher_table::hash_of(cypher));
+                return true;
+            });
+        }
+    }
+
+    // Visits the cyphers starting with prefix in order, until visit returns
+    // false. The scan starts at the last block whose first cypher sorts
+    // before prefix. Returns the number of cyphers visited.
+    template<typename Visitor>
+    size_t scan_prefix(cypher_view_t prefix, Visitor visit) const {
+        size_t block = partition_point(_blocks.begin(), _blocks.end(),
+                                       [&](size_t offset) {
+            const char *entry = _bytes.data() + offset;
+            read_varint(entry);
+            size_t length = read_varint(entry);
+            return cypher_view_t(entry, length) < prefix;
+        }) - _blocks.begin();
+
+        size_t visited = 0;
+        bool done = false;
+        value_t cypher;
+        for (block = block > 0 ? block - 1 : 0;
+             block < block_count() and not done; block++) {
+            for_each_entry(block, [&](size_t shared, cypher_view_t rest) {
+                cypher.resize(shared);
+                cypher.append(rest);
+                if (cypher < prefix)
+                    return true;
+
+                if (cypher.compare(0, prefix.size(), prefix) != 0) {
+                    done = true;
+                    return false;
+                }
+
+                visited++;
+                done = not visit(cypher_view_t(cypher));
+                return not done;
+            });
+        }
+
+        return visited;
+    }
+
+    // Builds an ordinary table with the same contents.
+    shared_ptr<cypher_table> expand(const allocator_hooks_t &hooks) const {
+        auto table = make_shared<cypher_table>(hooks);
+        table->reserve(_size);
+        for_each_in(0, block_count(), [&](cypher_view_t cypher, hash_t hash) {
+            table->insert(cypher, hash);
+        });
+
+        return table;
+    }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 16;
+    static constexpr size_t MIN_CAPACITY = 8;
+    // An index entry holds a fingerprint in its upper half and a block
+    // number in its lower half. Fingerprints are never zero, so neither
+    // is an entry in use.
+    static constexpr uint64_t EMPTY = 0;
+    static constexpr int BLOCK_BITS = 32;
+    static constexpr uint64_t BLOCK_MASK = (uint64_t(1) << BLOCK_BITS) - 1;
+
+    vector<uint64_t> _index;
+    vector<size_t> _blocks;
+    vector<char> _bytes;
+    size_t _size;
+
+    size_t home(hash_t hash) const {
+        return size_t((unsigned __int128)hash * _index.size() >> 64);
+    }
+
+    size_t next(size_t i) const { return i + 1 == _index.size() ? 0 : i + 1; }
+
+    static uint64_t fingerprint_of(hash_t hash) {
+        uint64_t fingerprint = uint32_t(hash);
+        return fingerprint == 0 ? 1 : fingerprint;
+    }
+
+    static size_t common_prefix(cypher_view_t a, cypher_view_t b) {
+        return mismatch(a.begin(), a.begin() + min(a.size(), b.size()),
+                        b.begin()).first - a.begin();
+    }
+
+    void place(hash_t hash, size_t block) {
+        size_t i = home(hash);
+        while (_index[i] != EMPTY)
+            i = next(i);
+        _index[i] = (fingerprint_of(hash) << BLOCK_BITS) | block;
+    }
+
+    void append_varint(size_t value) {
+        for (; value >= 0x80; value >>= 7)
+            _bytes.push_back(char((value & 0x7F) | 0x80));
+        _bytes.push_back(char(value));
+    }
+
+    static size_t read_varint(const char *&position) {
+        size_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            auto byte = static_cast<unsigned char>(*position++);
+            value |= size_t(byte & 0x7F) << shift;
+            if (byte < 0x80)
+                return value;
+        }
+    }
+
+    // Calls visit(shared, rest) for the entries of block in order, until
+    // it returns false.
+    template<typename Visitor>
+    void for_each_entry(size_t block, Visitor visit) const {
+        const char *position = _bytes.data() + _blocks[block];
+        size_t count = min(BLOCK_SIZE, _size - block * BLOCK_SIZE);
+        for (size_t i = 0; i < count; i++) {
+            size_t shared = read_varint(position);
+            size_t length = read_varint(position);
+            if (not visit(shared, cypher_view_t(position, length)))
+                return;
+            position += length;
+        }
+    }
+
+    // Tracks how long a prefix of cypher the current entry matches. An
+    // entry sharing more than that with its predecessor sorts before
+    // cypher just as the predecessor did; one sharing less sorts after it,
+    // and so does the rest of the block.
+    bool block_contains(size_t block, cypher_view_t cypher) const {
+        size_t matched = 0;
+        bool found = false;
+        for_each_entry(block, [&](size_t shared, cypher_view_t rest) {
+            if (shared > matched)
+                return true;
+            if (shared < matched)
+                return false;
+
+            cypher_view_t wanted = cypher.substr(matched);
+            matched += common_prefix(rest, wanted);
+            size_t end = shared + rest.size();
+            if (matched == end)
+                found = matched == cypher.size();
+            // The entry ends first, or differs by a smaller byte: the
+            // cypher may still come later in the block.
+            return not found and
+                   (matched == end or
+                    (matched < cypher.size() and
+                     static_cast<unsigned char>(rest[matched - shared]) <
+                     static_cast<unsigned char>(cypher[matched])));
+        });
+
+        return found;
+    }
+};
+
+// Set with copy-on-write storage. Copying into an empty set only shares the
+// table; whichever set sharing it is modified first takes a private copy.
+// A table mapped from a snapshot is treated as permanently shared.
+//
+// A set may also keep a Bloom filter of its hashes, which answers most
+// lookups for absent cyphers without touching the table, and ordered sets
+// keep a B+tree of their cyphers for prefix scans. The tree is shared along
+// with the table, and copied along with it. Both are rebuilt when the set
+// takes over contents of another set that lacks them. A filter gone
+// stale is rebuilt little by little instead, by the modifications that
+// follow.
+//
+// A compacted set keeps its contents in a compact table instead, which is
+// shared like a mapped one; the first modification expands it back.
+class cypher_set {
+public:
+    static hash_t hash_of(cypher_view_t cypher) {
+        return cypher_table::hash_of(cypher);
+    }
+
+    size_t size() const {
+        if (_compact)
+            return _compact->size();
+
+        return _table ? _table->size() : 0;
+    }
+
+    bool contains(cypher_view_t cypher, hash_t hash) const {
+        bool filtered = _bloom and not _bloom->stale();
+        if (filtered and not _bloom->may_contain(hash)) {
+            _bloom->count_rejection();
+            return false;
+        }
+
+        bool found = stored(cypher, hash);
+        if (filtered and not found)
+            _bloom->count_false_positive();
+
+        return found;
+    }
+
+    bool contains(cypher_view_t cypher) const {
+        return contains(cypher, hash_of(cypher));
+    }
+
+    // A shared table is copied only when the operation changes the set.
+    bool insert(cypher_view_t cypher, hash_t hash) {
+        refresh_bloom();
+        if (shared() and stored(cypher, hash))
+            return false;
+
+        if (not writable().insert(cypher, hash, bloom_observer()))
+            return false;
+
+        if (_tree) {
+            try {
+                writable_tree().insert(cypher);
+            }
+            catch (const bad_alloc &) {
+                _table->erase(cypher, hash, bloom_observer());
+                throw;
+            }
+        }
+
+        if (_bloom) {
+            _bloom->add(hash);
+            _bloom->note_insertion(size());
+        }
+        if (_fresh_bloom)
+            _fresh_bloom->add(hash);
+
+        return true;
+    }
+
+    bool insert(cypher_view_t cypher) {
+        return insert(cypher, hash_of(cypher));
+    }
+
+    bool erase(cypher_view_t cypher, hash_t hash) {
+        refresh_bloom();
+        if (size() == 0 or (shared() and not stored(cypher, hash)))
+            return false;
+
+        // The tree is copied first, as nothing may fail once the cypher is
+        // gone from the table.
+        cypher_tree *tree = _tree ? &writable_tree() : nullptr;
+        if (not writable().erase(cypher, hash, bloom_observer()))
+            return false;
+
+        if (tree)
+            tree->erase(cypher);
+        if (_bloom)
+            _bloom->note_removal(size());
+        if (_fresh_bloom)
+            _fresh_bloom->note_removal(size());
+
+        return true;
+    }
+
+    bool erase(cypher_view_t cypher) {
+        return erase(cypher, hash_of(cypher));
+    }
+
+    void prefetch(hash_t hash) const {
+        if (_bloom and not _bloom->stale())
+            _bloom->prefetch(hash);
+        else if (_compact)
+            _compact->prefetch(hash);
+        else if (_table)
+            _table->prefetch(hash);
+    }
+
+    // Rehashing moves every slot, so a rebuild of the filter starts over.
+    void reserve(size_t n) {
+        if (n > size()) {
+            writable().reserve(n);
+            _fresh_position = 0;
+        }
+    }
+
+    void clear() {
+        _table.reset();
+        _compact.reset();
+        if (_tree)
+            _tree = make_shared<cypher_tree>();
+        if (_bloom)
+            _bloom->reset(0);
+        _fresh_bloom.reset();
+    }
+
+    // Shares the table of other, and its tree, and copies its filter when
+    // it has an up-to-date one. Sets with different allocators never share
+    // a table.
+    void share(const cypher_set &other) {
+        _table = own(other._table);
+        _compact = other._compact;
+        if (_tree and other._tree)
+            _tree = other._tree;
+        else if (_tree)
+            rebuild_tree();
+        if (not _bloom)
+            return;
+
+        if (other._bloom and not other._bloom->stale()) {
+            _bloom->copy_bits(*other._bloom);
+            _fresh_bloom.reset();
+        }
+        else {
+            rebuild_bloom();
+        }
+    }
+
+    // Inserts the cyphers of other, calling visit(cypher, inserted) for
+    // each. They go into a copy of the table, which replaces it only once
+    // all of them are in, so running out of memory leaves the set as it
+    // was.
+    template<typename Visitor>
+    void merge(const cypher_set &other, Visitor visit) {
+        if (&other == this) {
+            for_each([&](cypher_view_t cypher) { visit(cypher, false); });
+            return;
+        }
+
+        shared_ptr<cypher_table> table;
+        if (_compact)
+            table = _compact->expand(_hooks);
+        else if (_table)
+            table = make_shared<cypher_table>(*_table, _hooks);
+        else
+            table = make_shared<cypher_table>(_hooks);
+
+        vector<bool> inserted;
+        inserted.reserve(other.size());
+        other.for_each_in(0, other.slot_count(),
+                          [&](cypher_view_t cypher, hash_t hash) {
+            inserted.push_back(table->insert(cypher, hash));
+        });
+
+        // Nothing is replaced when every cypher was there already. The copy
+        // places every slot anew.
+        cypher_tree *tree = nullptr;
+        if (table->size() > size()) {
+            if (_tree)
+                tree = &writable_tree();
+            _table = move(table);
+            _compact.reset();
+            _fresh_position = 0;
+        }
+
+        size_t i = 0;
+        other.for_each_in(0, other.slot_count(),
+                          [&](cypher_view_t cypher, hash_t hash) {
+            if (inserted[i]) {
+                if (tree)
+                    tree->insert(cypher);
+                if (_bloom)
+                    _bloom->add(hash);
+                if (_fresh_bloom)
+                    _fresh_bloom->add(hash);
+            }
+            visit(cypher, inserted[i++]);
+        });
+        if (_bloom)
+            _bloom->note_insertion(size());
+    }
+
+    void adopt(shared_ptr<cypher_table> table) {
+        _table = own(move(table));
+        _compact.reset();
+        if (_tree)
+            rebuild_tree();
+        if (_bloom)
+            rebuild_bloom();
+    }
+
+    // Takes over the contents of other, keeping the options of this set.
+    void replace_contents(cypher_set &&other) {
+        adopt(move(other._table));
+    }
+
+    // Exchanges the contents with other, keeping the options of both sets.
+    // Takes constant time unless the sets use different allocators, or
+    // only one of them is ordered or keeps a Bloom filter.
+    void swap_contents(cypher_set &other) {
+        if (_hooks == other._hooks) {
+            _table.swap(other._table);
+        }
+        else {
+            auto table = own(other._table);
+            auto other_table = other.own(_table);
+            _table = move(table);
+            other._table = move(other_table);
+        }
+        _compact.swap(other._compact);
+
+        if (_tree and other._tree) {
+            _tree.swap(other._tree);
+        }
+        else {
+            if (_tree)
+                rebuild_tree();
+            if (other._tree)
+                other.rebuild_tree();
+        }
+
+        if (_bloom and other._bloom) {
+            _bloom.swap(other._bloom);
+            _fresh_bloom.swap(other._fresh_bloom);
+            std::swap(_fresh_position, other._fresh_position);
+        }
+        else {
+            if (_bloom)
+                rebuild_bloom();
+            if (other._bloom)
+                other.rebuild_bloom();
+        }
+    }
+
+    void enable_bloom() {
+        if (not _bloom) {
+            _bloom = make_unique<bloom_filter>(size());
+            rebuild_bloom();
+        }
+    }
+
+    void disable_bloom() {
+        _bloom.reset();
+        _fresh_bloom.reset();
+    }
+
+    void enable_order() {
+        if (not _tree) {
+            _tree = make_shared<cypher_tree>();
+            rebuild_tree();
+        }
+    }
+
+    bool ordered() const { return _tree != nullptr; }
+
+    // Ordered and compacted sets find the first cypher with the prefix,
+    // the others scan the whole table.
+    template<typename Visitor>
+    size_t scan_prefix(cypher_view_t prefix, Visitor visit) const {
+        if (_tree)
+            return _tree->scan_prefix(prefix, visit);
+        if (_compact)
+            return _compact->scan_prefix(prefix, visit);
+
+        size_t visited = 0;
+        bool stopped = false;
+        for_each([&](cypher_view_t cypher) {
+            if (stopped or cypher.substr(0, prefix.size()) != prefix)
+                return;
+
+            visited++;
+            stopped = not visit(cypher);
+        });
+
+        return visited;
+    }
+
+    const bloom_filter *bloom() const { return _bloom.get(); }
+
+    // Freezes the contents into a compact table.
+    void compact() {
+        if (_compact)
+            return;
+
+        vector<cypher_view_t> cyphers;
+        cyphers.reserve(size());
+        for_each([&](cypher_view_t cypher) { cyphers.push_back(cypher); });
+        sort(cyphers.begin(), cyphers.end());
+
+        _compact = make_shared<const compact_table>(cyphers);
+        _table.reset();
+        _fresh_position = 0;
+    }
+
+    bool compacted() const { return _compact != nullptr; }
+
+    void expand() {
+        if (_compact) {
+            _table = _compact->expand(_hooks);
+            _compact.reset();
+            _fresh_position = 0;
+        }
+    }
+
+    // A table shared with other sets is counted in full by each of them.
+    size_t table_bytes() const {
+        if (_compact)
+            return _compact->index_bytes();
+
+        return _table ? _table->slot_bytes() : 0;
+    }
+
+    size_t payload_bytes() const {
+        if (_compact)
+            return _compact->payload_bytes();
+
+        return _table ? _table->payload_bytes() : 0;
+    }
+
+    size_t node_bytes() const {
+        return sizeof(*this) + (_table ? sizeof(cypher_table) : 0) +
+               (_compact ? sizeof(compact_table) : 0) +
+               (_bloom ? _bloom->memory_usage() : 0) +
+               (_tree ? _tree->memory_usage() : 0);
+    }
+
+    // Moves the contents into memory from the given hooks. The Bloom
+    // filter stays on the default allocator, as it needs aligned blocks,
+    // and so do the tree and a compact table, which are made of standard
+    // containers.
+    void use_allocator(const allocator_hooks_t &hooks) {
+        _hooks = hooks;
+        if (_table and _table->hooks() != _hooks) {
+            _table = make_shared<cypher_table>(*_table, _hooks);
+            _fresh_position = 0;
+        }
+    }
+
+    void write_snapshot(ostream &stream) const {
+        if (_compact)
+            _compact->expand({})->write_snapshot(stream);
+        else if (_table)
+            _table->write_snapshot(stream);
+        else
+            cypher_table().write_snapshot(stream);
+    }
+
+    // The views are only valid during the call when the set is compacted.
+    template<typename Visitor>
+    void for_each(Visitor visit) const {
+        if (_compact)
+            _compact->for_each(visit);
+        else if (_table)
+            _table->for_each(visit);
+    }
+
+    size_t slot_count() const {
+        if (_compact)
+            return _compact->block_count();
+
+        return _table ? _table->slot_count() : 0;
+    }
+
+    // Holding on to the table counts as sharing it, so it stays unchanged
+    // until released: the set copies it on its next modification instead.
+    // A compacted set returns an expanded copy of its contents.
+    shared_ptr<const cypher_table> table() const {
+        if (_compact)
+            return _compact->expand(_hooks);
+
+        return _table;
+    }
+
+    template<typename Visitor>
+    void for_each_in(size_t first, size_t last, Visitor visit) const {
+        if (_compact)
+            _compact->for_each_in(first, last, visit);
+        else if (_table)
+            _table->for_each_in(first, last, visit);
+    }
+
+private:
+    shared_ptr<cypher_table> _table;
+    shared_ptr<const compact_table> _compact;
+    unique_ptr<bloom_filter> _bloom;
+    // Filter being rebuilt while _bloom is stale, complete for the slots
+    // before _fresh_position.
+    unique_ptr<bloom_filter> _fresh_bloom;
+    size_t _fresh_position = 0;
+    shared_ptr<cypher_tree> _tree;
+    allocator_hooks_t _hooks;
+
+    static constexpr size_t BLOOM_REBUILD_STEP = 32;
+
+    shared_ptr<cypher_table> own(shared_ptr<cypher_table> table) const {
+        if (table and not table->mapped() and table->hooks() != _hooks)
+            return make_shared<cypher_table>(*table, _hooks);
+
+        return table;
+    }
+
+    bool shared() const {
+        return _compact or
+               (_table and (_table.use_count() > 1 or _table->mapped()));
+    }
+
+    bool stored(cypher_view_t cypher, hash_t hash) const {
+        if (_compact)
+            return _compact->contains(cypher, hash);
+
+        return _table and _table->contains(cypher, hash);
+    }
+
+    cypher_table &writable() {
+        expand();
+
+        if (not _table) {
+            _table = make_shared<cypher_table>(_hooks);
+        }
+        else if (_table.use_count() > 1 or _table->mapped()) {
+            // The copy places pending slots anew.
+            _table = make_shared<cypher_table>(*_table, _hooks);
+            _fresh_position = 0;
+        }
+        else {
+            // Orders our writes after the reads of a set that has just
+            // dropped its share of the table.
+            atomic_thread_fence(memory_order_acquire);
+        }
+
+        return *_table;
+    }
+
+    void rebuild_bloom() {
+        _bloom->reset(size());
+        _fresh_bloom.reset();
+        for_each_in(0, slot_count(), [&](cypher_view_t, hash_t hash) {
+            _bloom->add(hash);
+        });
+    }
+
+    // Like writable(), for the tree. The fence taken there orders the
+    // writes to the tree as well.
+    cypher_tree &writable_tree() {
+        if (_tree.use_count() > 1)
+            _tree = make_shared<cypher_tree>(*_tree);
+
+        return *_tree;
+    }
+
+    // The cyphers are inserted in order, so that every insertion goes to
+    // the rightmost leaf. A compact table yields them in order already.
+    // The new tree replaces the old one, which other sets may share.
+    void rebuild_tree() {
+        auto tree = make_shared<cypher_tree>();
+        if (_compact) {
+            _compact->for_each([&](cypher_view_t cypher) {
+                tree->insert(cypher);
+            });
+            _tree = move(tree);
+            return;
+        }
+
+        vector<cypher_view_t> cyphers;
+        cyphers.reserve(size());
+        for_each([&](cypher_view_t cypher) { cyphers.push_back(cypher); });
+        sort(cyphers.begin(), cyphers.end());
+
+        for (auto cypher : cyphers)
+            tree->insert(cypher);
+        _tree = move(tree);
+    }
+
+    // Slots which move behind the position of the rebuild are added to the
+    // fresh filter as they move.
+    struct bloom_observer_t {
+        bloom_filter *fresh;
+
+        void operator()(hash_t hash) const {
+            if (fresh)
+                fresh->add(hash);
+        }
+    };
+
+    bloom_observer_t bloom_observer() { return {_fresh_bloom.get()}; }
+
+    // Every modification adds the hashes of the next BLOOM_REBUILD_STEP
+    // slots to the fresh filter, which takes over once it has seen them all.
+    void refresh_bloom() {
+        if (not _bloom or (not _bloom->stale() and not _fresh_bloom))
+            return;
+
+        if (not _fresh_bloom) {
+            _fresh_bloom = make_unique<bloom_filter>(size());
+            _fresh_position = 0;
+        }
+
+        size_t last = min(_fresh_position + BLOOM_REBUILD_STEP, slot_count());
+        for_each_in(_fresh_position, last, [&](cypher_view_t, hash_t hash) {
+            _fresh_bloom->add(hash);
+        });
+        _fresh_position = last;
+
+        if (_fresh_position >= slot_count()) {
+            _bloom->take_bits(*_fresh_bloom);
+            _fresh_bloom.reset();
+        }
+    }
+};
+
+using set_t = cypher_set;
+
+// An id packs a slot index (low half of the bits) with the generation of the
+// slot (high half). Deleting a set bumps the generation of its slot, so the
+// slot can be reused while the old id stays invalid.
+constexpr int INDEX_BITS = numeric_limits<identifier_t>::digits / 2;
+constexpr identifier_t INDEX_MASK = (identifier_t(1) << INDEX_BITS) - 1;
+constexpr identifier_t MAX_GENERATION =
+    numeric_limits<identifier_t>::max() >> INDEX_BITS;
+
+// Each set sits in a slot guarded by its own reader/writer lock. Slots live
+// in chunks that are never moved, the k-th chunk holding
+// FIRST_CHUNK_SIZE << k slots, so resolving an id needs no table-wide lock.
+struct handle_slot_t {
+    atomic<identifier_t> generation{0};
+    atomic<bool> live{false};
+    set_mutex_t mutex;
+    set_t set;
+};
+
+constexpr identifier_t FIRST_CHUNK_SIZE = 1024;
+constexpr size_t CHUNKS = numeric_limits<identifier_t>::digits;
+
+class slot_chunks_t {
+public:
+    ~slot_chunks_t() {
+        for (auto &chunk : _chunks)
+            delete[] chunk.load();
+    }
+
+    handle_slot_t *find(identifier_t index) const {
+        auto chunk = chunk_number(index);
+        if (chunk >= CHUNKS)
+            return nullptr;
+
+        auto slots = _chunks[chunk].load(memory_order_acquire);
+        return slots ? &slots[offset_in_chunk(index, chunk)] : nullptr;
+    }
+
+    handle_slot_t &get_or_allocate(identifier_t index) {
+        auto chunk = chunk_number(index);
+        auto slots = _chunks[chunk].load(memory_order_acquire);
+
+        if (not slots) {
+            auto allocated = new handle_slot_t[FIRST_CHUNK_SIZE << chunk];
+            if (_chunks[chunk].compare_exchange_strong(slots, allocated,
+                                                       memory_order_acq_rel))
+                slots = allocated;
+            else
+                delete[] allocated;
+        }
+
+        return slots[offset_in_chunk(index, chunk)];
+    }
+
+private:
+    array<atomic<handle_slot_t *>, CHUNKS> _chunks{};
+
+    static size_t chunk_number(identifier_t index) {
+        identifier_t q = index / FIRST_CHUNK_SIZE + 1;
+        return numeric_limits<identifier_t>::digits - 1 - __builtin_clzl(q);
+    }
+
+    static identifier_t offset_in_chunk(identifier_t index, size_t chunk) {
+        return index - FIRST_CHUNK_SIZE * ((identifier_t(1) << chunk) - 1);
+    }
+};
+
+using free_list_t = vector<identifier_t>;
+
+slot_chunks_t &handle_table() {
+    static slot_chunks_t handle_table;
+    return handle_table;
+}
+
+atomic<identifier_t> &number_of_created_slots() {
+    static atomic<identifier_t> number_of_created_slots{0};
+    return number_of_created_slots;
+}
+
+free_list_t &free_slots() {
+    static free_list_t free_slots;
+    return free_slots;
+}
+
+table_mutex_t &free_slots_mutex() {
+    static table_mutex_t free_slots_mutex;
+    return free_slots_mutex;
+}
+
+identifier_t slot_index(identifier_t id) {
+    return id & INDEX_MASK;
+}
+
+identifier_t slot_generation(identifier_t id) {
+    return id >> INDEX_BITS;
+}
+
+bool holds_set(const handle_slot_t &slot, identifier_t id) {
+    return slot.live.load(memory_order_acquire) and
+           slot.generation.load(memory_order_relaxed) == slot_generation(id);
+}
+
+// Locks the slot of id with lock and returns its set, or returns nullptr
+// and leaves lock empty when there is no such set.
+template<typename Lock>
+set_t *find_set(identifier_t id, Lock &lock) {
+    auto slot = handle_table().find(slot_index(id));
+    if (not slot)
+        return nullptr;
+
+    lock = Lock(slot->mutex);
+    if (not holds_set(*slot, id)) {
+        lock = Lock();
+        return nullptr;
+    }
+
+    return &slot->set;
+}
+
+// Installs set in a free slot and only then marks the slot live, so no
+// other thread sees the set before it is configured. Returns
+// ENCSTRSET_INVALID_ID once every slot index has been handed out; a larger
+// index would spill into the generation bits of the id.
+identifier_t create_set(set_t set = set_t()) {
+    identifier_t index;
+    {
+        lock_guard<table_mutex_t> guard(free_slots_mutex());
+        if (free_slots().empty()) {
+            if (number_of_created_slots().load() >= INDEX_MASK)
+                return ENCSTRSET_INVALID_ID;
+            index = number_of_created_slots().fetch_add(1);
+        }
+        else {
+            index = free_slots().back();
+            free_slots().pop_back();
+        }
+    }
+
+    auto &slot = handle_table().get_or_allocate(index);
+    identifier_t generation;
+    {
+        write_lock_t lock(slot.mutex);
+        slot.set = move(set);
+        generation = slot.generation.load();
+        slot.live.store(true, memory_order_release);
+    }
+
+    return generation << INDEX_BITS | index;
+}
+
+// Must be called with the slot of id write-locked.
+bool destroy_set(identifier_t id) {
+    auto &slot = *handle_table().find(slot_index(id));
+
+    // Options go too, the next set in this slot starts with the defaults.
+    slot.set = set_t();
+    slot.live.store(false, memory_order_release);
+
+    // A slot whose generation would wrap around is retired for good.
+    if (slot.generation.load() == MAX_GENERATION)
+        return false;
+
+    slot.generation.fetch_add(1);
+    return true;
+}
+
+void recycle_slot(identifier_t id) {
+    lock_guard<table_mutex_t> guard(free_slots_mutex());
+    free_slots().push_back(slot_index(id));
+}
+
+// Diagnostics are handed to a writer thread through a bounded lock-free
+// queue (Vyukov's), so a call only pays for formatting its message. The
+// queue is drained in batches, one write to cerr per batch, by whoever holds
+// _drain_mutex: the writer thread, or a thread flushing it. A full queue
+// makes producers wait, so no message is ever dropped or reordered.
+class debug_sink_t {
+public:
+    debug_sink_t() : _cells(new cell_t[CAPACITY]) {
+        for (size_t i = 0; i < CAPACITY; i++)
+            _cells[i].sequence.store(i, memory_order_relaxed);
+
+        _writer = thread([this] { run(); });
+    }
+
+    void push(debug_message_t message) {
+        size_t position = _enqueue_position.load(memory_order_relaxed);
+        cell_t *cell;
+
+        while (true) {
+            cell = &_cells[position & MASK];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            auto difference = intptr_t(sequence) - intptr_t(position);
+
+            if (difference == 0) {
+                if (_enqueue_position.compare_exchange_weak(
+                        position, position + 1, memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0) {
+                if (_stopped.load())
+                    flush();
+                else
+                    wake_writer();
+                this_thread::yield();
+                position = _enqueue_position.load(memory_order_relaxed);
+            }
+            else {
+                position = _enqueue_position.load(memory_order_relaxed);
+            }
+        }
+
+        cell->message = move(message);
+        cell->sequence.store(position + 1, memory_order_release);
+
+        // Once the writer is gone, messages are written straight away.
+        atomic_thread_fence(memory_order_seq_cst);
+        if (_stopped.load())
+            flush();
+        else if (_idle.load(memory_order_relaxed))
+            wake_writer();
+    }
+
+    void flush() {
+        lock_guard<mutex> guard(_drain_mutex);
+        drain();
+    }
+
+    // Stops the writer thread and writes out what it left behind.
+    void stop() {
+        _stopped.store(true);
+        {
+            lock_guard<mutex> guard(_wake_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _writer.join();
+
+        flush();
+    }
+
+private:
+    struct cell_t {
+        atomic<size_t> sequence;
+        debug_message_t message;
+    };
+
+    static constexpr size_t CAPACITY = 1 << 12;
+    static constexpr size_t MASK = CAPACITY - 1;
+    static constexpr size_t BATCH_BYTES = 1 << 16;
+    static constexpr auto IDLE_WAIT = chrono::milliseconds(10);
+
+    unique_ptr<cell_t[]> _cells;
+    atomic<size_t> _enqueue_position{0};
+    size_t _dequeue_position = 0;
+    mutex _drain_mutex;
+
+    thread _writer;
+    mutex _wake_mutex;
+    condition_variable _wake;
+    atomic<bool> _idle{false};
+    bool _stopping = false;
+    atomic<bool> _stopped{false};
+
+    // Takes _drain_mutex held; returns the number of messages written.
+    size_t drain() {
+        string batch;
+        size_t written = 0;
+
+        while (true) {
+            auto &cell = _cells[_dequeue_position & MASK];
+            if (cell.sequence.load(memory_order_acquire) !=
+                _dequeue_position + 1)
+                break;
+
+            batch += cell.message;
+            batch += '\n';
+            cell.message.clear();
+            cell.sequence.store(_dequeue_position + CAPACITY,
+                                memory_order_release);
+            _dequeue_position++;
+            written++;
+
+            if (batch.size() >= BATCH_BYTES) {
+                cerr.write(batch.data(), batch.size());
+                batch.clear();
+            }
+        }
+
+        cerr.write(batch.data(), batch.size());
+        cerr.flush();
+
+        return written;
+    }
+
+    // A missed wake-up only delays the writer by IDLE_WAIT.
+    void wake_writer() {
+        if (_idle.exchange(false)) {
+            lock_guard<mutex> guard(_wake_mutex);
+            _wake.notify_one();
+        }
+    }
+
+    void run() {
+        unique_lock<mutex> wake_lock(_wake_mutex);
+        while (not _stopping) {
+            wake_lock.unlock();
+            size_t written;
+            {
+                lock_guard<mutex> guard(_drain_mutex);
+                written = drain();
+            }
+            wake_lock.lock();
+
+            if (written == 0) {
+                _idle.store(true);
+                _wake.wait_for(wake_lock, IDLE_WAIT, [&] {
+                    return not _idle.load() or _stopping;
+                });
+                _idle.store(false);
+            }
+        }
+    }
+};
+
+// The sink is never destroyed, so that diagnostics from destructors of
+// static objects still get written: the handler registered with atexit()
+// only stops its writer thread.
+debug_sink_t &debug_sink() {
+    static debug_sink_t *sink = [] {
+        auto created = new debug_sink_t;
+        atexit([] { debug_sink().stop(); });
+        return created;
+    }();
+
+    return *sink;
 }
 
-identifier_t &number_of_created_sets() {
-    static identifier_t number_of_created_sets = 0;
-    return number_of_created_sets;
+void write_debug_info(const debug_message_t &s) {
+    debug_sink().push(s);
 }
 
-void debug_info(const debug_message_t &s) {
-    if (DEBUG)
-        cerr << s << endl;
+// Writes a diagnostic. Builds without diagnostics do not even format the
+// message, which would otherwise cost more than most operations.
+#define DEBUG_INFO(...) (DEBUG ? write_debug_info(__VA_ARGS__) : void())
+
+debug_message_t string_to_hex(cypher_view_t cypher) {
+    stringstream stream;
+    for (auto c : cypher)
+        stream << setw(2) << setfill('0') << uppercase << hex
+               << static_cast<int>(static_cast<unsigned char>(c)) << ' ';
+
+    auto hex_string = stream.str();
+    if (not hex_string.empty())
+        hex_string.pop_back();
+
+    return hex_string;
+}
+
+size_t length_of(const char *text) {
+    return text ? strlen(text) : (size_t)0;
+}
+
+// Key as applied by cyphering(). data holds the key repeated to length
+// bytes, a multiple of key_length; data == NULL means no encryption.
+struct key_stream_t {
+    key_argument_t data;
+    size_t key_length;
+    size_t length;
+};
+
+key_stream_t plain_key(key_argument_t key, size_t key_length) {
+    return {key, key_length, key_length};
+}
+
+// Long enough for the XOR loop to run on whole vector registers.
+constexpr size_t KEY_STREAM_MIN = 64;
+
+value_t expand_key(key_argument_t key, size_t key_length) {
+    value_t stream(key, key_length);
+    while (key_length > 0 and stream.size() < KEY_STREAM_MIN)
+        stream.append(key, key_length);
+
+    return stream;
+}
+
+// Writes the cypher into a caller-owned buffer, so that batches can reuse
+// its capacity. The key stream is applied one stretch at a time, which
+// keeps the modulo out of the inner loop and lets it vectorize.
+void cyphering(value_argument_t value, size_t value_length,
+               const key_stream_t &key, value_t &cypher) {
+    cypher.assign(value, value_length);
+
+    if (!key.data or key.length == 0)
+        return;
+
+    char *data = cypher.data();
+    for (size_t offset = 0; offset < value_length; offset += key.length) {
+        size_t stretch = min(key.length, value_length - offset);
+        for (size_t i = 0; i < stretch; i++)
+            data[offset + i] ^= key.data[i];
+    }
+}
+
+// Quotes an argument for the diagnostics, NULL is printed bare.
+debug_message_t quoted(const char *text, size_t length) {
+    return text ? "\"" + string(text, length) + "\"" : "NULL";
+}
+
+debug_message_t quoted(const char *text) {
+    return quoted(text, length_of(text));
+}
+
+bool exists_in_table(const set_t *set_pointer) {
+    return set_pointer != nullptr;
+}
+
+// Custom allocator hooks may refuse memory. The modification then fails
+// and leaves the set as it was.
+template<typename Modification>
+optional<bool> try_modify(const debug_message_t &function_name,
+                          identifier_t id, Modification modification) {
+    try {
+        return modification();
+    }
+    catch (const bad_alloc &) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                   ", out of memory");
+
+        return nullopt;
+    }
+}
+
+constexpr size_t BATCH_WINDOW = 16;
+
+// Shared body of the batch entry points. The set is resolved once, then
+// values are cyphered and hashed a window at a time, and the home slots of
+// the whole window are prefetched before any of them is probed. key_of(i)
+// returns the key stream of the i-th value.
+template<typename Lock, typename KeyOf, typename Operation>
+size_t apply_batch(const debug_message_t &function_name, identifier_t id,
+                   values_argument_t values, size_t count, KeyOf key_of,
+                   results_argument_t results, size_t reservation,
+                   const debug_message_t &outcome, Operation operation) {
+    if (results)
+        fill(results, results + count, false);
+
+    if (!values and count > 0) {
+        DEBUG_INFO(function_name + ": invalid values (NULL)");
+
+        return 0;
+    }
+
+    Lock lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                   " does not exist");
+
+        return 0;
+    }
+
+    try_modify(function_name, id, [&] {
+        set_pointer->reserve(set_pointer->size() + reservation);
+        return true;
+    });
+
+    array<value_t, BATCH_WINDOW> cyphers;
+    array<hash_t, BATCH_WINDOW> hashes;
+    size_t done = 0;
+
+    for (size_t first = 0; first < count; first += BATCH_WINDOW) {
+        size_t window = min(BATCH_WINDOW, count - first);
+
+        for (size_t i = 0; i < window; i++) {
+            if (!values[first + i])
+                continue;
+
+            cyphering(values[first + i], strlen(values[first + i]),
+                      key_of(first + i), cyphers[i]);
+            hashes[i] = set_t::hash_of(cyphers[i]);
+            set_pointer->prefetch(hashes[i]);
+        }
+
+        for (size_t i = 0; i < window; i++) {
+            if (!values[first + i]) {
+                DEBUG_INFO(function_name + ": invalid value (NULL) at " +
+                           to_string(first + i));
+                continue;
+            }
+
+            bool result = try_modify(function_name, id, [&] {
+                return operation(*set_pointer, cyphers[i], hashes[i]);
+            }).value_or(false);
+            if (results)
+                results[first + i] = result;
+            done += result;
+        }
+    }
+
+    DEBUG_INFO(function_name + ": set #" + to_string(id) + ", " +
+               to_string(done) + " of " + to_string(count) + " cypher(s) " +
+               outcome);
+
+    return done;
+}
+
+// Every value of the batch is cyphered with the same key.
+auto shared_key(key_argument_t key) {
+    auto stream = plain_key(key, length_of(key));
+    return [stream](size_t) { return stream; };
+}
+
+// The i-th value is cyphered with the i-th key, a NULL array means no keys.
+auto key_array(keys_argument_t keys) {
+    return [keys](size_t i) {
+        key_argument_t key = keys ? keys[i] : nullptr;
+        return plain_key(key, length_of(key));
+    };
+}
+
+debug_message_t batch_call(const debug_message_t &function_name,
+                           identifier_t id, size_t count) {
+    return function_name + "(" + to_string(id) + ", " + to_string(count) +
+           " value(s)";
+}
+
+bool insert_hashed(set_t &set, cypher_view_t cypher, hash_t hash) {
+    return set.insert(cypher, hash);
+}
+
+bool erase_hashed(set_t &set, cypher_view_t cypher, hash_t hash) {
+    return set.erase(cypher, hash);
+}
+
+bool contains_hashed(const set_t &set, cypher_view_t cypher, hash_t hash) {
+    return set.contains(cypher, hash);
+}
+
+constexpr size_t PARALLEL_THRESHOLD = 1 << 16;
+constexpr size_t MAX_WORKERS = 16;
+
+size_t workers_for(size_t elements) {
+    if (elements < PARALLEL_THRESHOLD)
+        return 1;
+
+    return clamp<size_t>(thread::hardware_concurrency(), 1, MAX_WORKERS);
+}
+
+// Runs work(0), ..., work(workers - 1), all but the first on new threads.
+template<typename Work>
+void run_in_parallel(size_t workers, Work work) {
+    vector<thread> threads;
+    for (size_t worker = 1; worker < workers; worker++)
+        threads.emplace_back(work, worker);
+
+    work(0);
+
+    for (auto &worker_thread : threads)
+        worker_thread.join();
+}
+
+using matches_t = vector<pair<cypher_view_t, hash_t>>;
+
+// Returns the cyphers of scanned which are present (or absent) in probed.
+// The views stay valid as long as scanned is locked and not modified.
+matches_t collect(const set_t &scanned, const set_t &probed, bool present) {
+    size_t slots = scanned.slot_count();
+    size_t workers = workers_for(scanned.size());
+    vector<matches_t> parts(workers);
+
+    run_in_parallel(workers, [&](size_t worker) {
+        scanned.for_each_in(slots * worker / workers,
+                            slots * (worker + 1) / workers,
+                            [&](cypher_view_t cypher, hash_t hash) {
+            if (probed.contains(cypher, hash) == present)
+                parts[worker].emplace_back(cypher, hash);
+        });
+    });
+
+    matches_t matches;
+    for (const auto &part : parts)
+        matches.insert(matches.end(), part.begin(), part.end());
+
+    return matches;
+}
+
+set_t union_of(const set_t &a, const set_t &b) {
+    const auto &larger = a.size() >= b.size() ? a : b;
+    const auto &smaller = a.size() >= b.size() ? b : a;
+    auto missing = collect(smaller, larger, false);
+
+    set_t result;
+    result.share(larger);
+    result.reserve(larger.size() + missing.size());
+    for (const auto &[cypher, hash] : missing)
+        result.insert(cypher, hash);
+
+    return result;
+}
+
+set_t intersection_of(const set_t &a, const set_t &b) {
+    const auto &larger = a.size() >= b.size() ? a : b;
+    const auto &smaller = a.size() >= b.size() ? b : a;
+    auto common = collect(smaller, larger, true);
+
+    set_t result;
+    result.reserve(common.size());
+    for (const auto &[cypher, hash] : common)
+        result.insert(cypher, hash);
+
+    return result;
+}
+
+set_t difference_of(const set_t &a, const set_t &b) {
+    set_t result;
+
+    if (a.size() <= b.size()) {
+        auto kept = collect(a, b, false);
+        result.reserve(kept.size());
+        for (const auto &[cypher, hash] : kept)
+            result.insert(cypher, hash);
+    }
+    else {
+        auto dropped = collect(b, a, true);
+        result.share(a);
+        for (const auto &[cypher, hash] : dropped)
+            result.erase(cypher, hash);
+    }
+
+    return result;
+}
+
+// Sets bit i of a cleared bitmap (bit i % 8 of byte i / 8) when set ids[i]
+// contains the cypher. Workers get whole bytes of the bitmap, so they never
+// write to the same byte; ids which do not name a set leave their bit clear.
+size_t contained_in_sets(ids_argument_t ids, size_t count,
+                         cypher_view_t cypher, hash_t hash,
+                         bitmap_argument_t bitmap) {
+    size_t bytes = (count + 7) / 8;
+    size_t workers = min(workers_for(count), max<size_t>(bytes, 1));
+    vector<size_t> found(workers, 0);
+
+    run_in_parallel(workers, [&](size_t worker) {
+        size_t first = bytes * worker / workers * 8;
+        size_t last = min(count, bytes * (worker + 1) / workers * 8);
+
+        for (size_t i = first; i < last; i++) {
+            read_lock_t lock;
+            auto set_pointer = find_set(ids[i], lock);
+
+            if (exists_in_table(set_pointer) and
+                set_pointer->contains(cypher, hash)) {
+                if (bitmap)
+                    bitmap[i / 8] |= (unsigned char)(1u << (i % 8));
+                found[worker]++;
+            }
+        }
+    });
+
+    return accumulate(found.begin(), found.end(), (size_t)0);
+}
+
+// Unmaps a snapshot once the last table reading from it is gone.
+class snapshot_mapping_t {
+public:
+    snapshot_mapping_t(void *address, size_t length)
+            : _address(address), _length(length) {}
+
+    snapshot_mapping_t(const snapshot_mapping_t &) = delete;
+
+    snapshot_mapping_t &operator=(const snapshot_mapping_t &) = delete;
+
+    ~snapshot_mapping_t() { munmap(_address, _length); }
+
+private:
+    void *_address;
+    size_t _length;
+};
+
+bool valid_snapshot(const cypher_table::snapshot_header_t &header,
+                    size_t file_size) {
+    using slot_t = cypher_table::slot_t;
+    constexpr auto max_slots =
+        numeric_limits<size_t>::max() / 2 / sizeof(slot_t);
+
+    if (header.magic != cypher_table::SNAPSHOT_MAGIC or
+        header.slot_size != sizeof(slot_t) or
+        header.hash_check != cypher_table::snapshot_hash_check() or
+        header.slot_count > max_slots or
+        (header.slot_count & (header.slot_count - 1)) != 0 or
+        header.size * 2 > header.slot_count)
+        return false;
+
+    size_t payload = file_size - sizeof(header);
+    size_t slot_bytes = header.slot_count * sizeof(slot_t);
+
+    return slot_bytes <= payload and header.arena_size == payload - slot_bytes;
+}
+
+// Maps the snapshot at path read-only, or returns nullptr if the file cannot
+// be mapped, was not written by encstrset_save of a compatible build, or was
+// truncated or corrupted since. Checking the slots reads all of them once.
+shared_ptr<cypher_table> map_snapshot(path_argument_t path) {
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+        return nullptr;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 or
+        static_cast<size_t>(status.st_size) <
+            sizeof(cypher_table::snapshot_header_t)) {
+        close(descriptor);
+        return nullptr;
+    }
+
+    size_t length = status.st_size;
+    void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor,
+                         0);
+    close(descriptor);
+    if (address == MAP_FAILED)
+        return nullptr;
+
+    auto mapping = make_shared<snapshot_mapping_t>(address, length);
+    auto data = static_cast<const char *>(address);
+
+    cypher_table::snapshot_header_t header;
+    memcpy(&header, data, sizeof(header));
+    if (not valid_snapshot(header, length) or
+        not cypher_table::valid_slots(header, data + sizeof(header)))
+        return nullptr;
+
+    return make_shared<cypher_table>(header, data + sizeof(header), mapping);
+}
+
+// Writes next to path first, so that a failed save leaves path untouched.
+bool save_snapshot(const set_t &set, path_argument_t path) {
+    string temporary_path = string(path) + ".tmp";
+
+    ofstream stream(temporary_path, ios::binary | ios::trunc);
+    set.write_snapshot(stream);
+    stream.close();
+
+    if (not stream or rename(temporary_path.c_str(), path) != 0) {
+        remove(temporary_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+set_t *resolve_set(identifier_t id) {
+    auto slot = handle_table().find(slot_index(id));
+
+    return slot and holds_set(*slot, id) ? &slot->set : nullptr;
+}
+
+struct group_lock_t {
+    write_lock_t dst_lock;
+    vector<read_lock_t> src_locks;
+};
+
+// Locks the slot of dst_id exclusively and the slots of src_ids shared, in
+// index order like encstrset_copy does.
+void lock_group(identifier_t dst_id, const vector<identifier_t> &src_ids,
+                group_lock_t &locks) {
+    vector<identifier_t> indices{slot_index(dst_id)};
+    for (auto id : src_ids)
+        indices.push_back(slot_index(id));
+
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+
+    for (auto index : indices) {
+        auto slot = handle_table().find(index);
+        if (not slot)
+            continue;
+
+        if (index == slot_index(dst_id))
+            locks.dst_lock = write_lock_t(slot->mutex);
+        else
+            locks.src_locks.emplace_back(slot->mutex);
+    }
+}
+
+// Locks the slots of a_id and b_id exclusively, in index order like
+// encstrset_copy does, and returns their sets.
+pair<set_t *, set_t *> lock_pair(identifier_t a_id, identifier_t b_id,
+                                 write_lock_t &a_lock, write_lock_t &b_lock) {
+    if (slot_index(a_id) == slot_index(b_id)) {
+        auto slot = handle_table().find(slot_index(a_id));
+        if (slot)
+            a_lock = write_lock_t(slot->mutex);
+    }
+    else if (slot_index(a_id) < slot_index(b_id)) {
+        if (auto slot = handle_table().find(slot_index(a_id)))
+            a_lock = write_lock_t(slot->mutex);
+        if (auto slot = handle_table().find(slot_index(b_id)))
+            b_lock = write_lock_t(slot->mutex);
+    }
+    else {
+        if (auto slot = handle_table().find(slot_index(b_id)))
+            b_lock = write_lock_t(slot->mutex);
+        if (auto slot = handle_table().find(slot_index(a_id)))
+            a_lock = write_lock_t(slot->mutex);
+    }
+
+    return {resolve_set(a_id), resolve_set(b_id)};
+}
+
+// Shared body of encstrset_move and encstrset_swap.
+bool exchange_contents(const debug_message_t &function_name,
+                       identifier_t a_id, identifier_t b_id, bool clear_a) {
+    DEBUG_INFO(function_name + "(" + to_string(a_id) + ", " +
+               to_string(b_id) + ")");
+
+    write_lock_t a_lock, b_lock;
+    auto [a_set_pointer, b_set_pointer] = lock_pair(a_id, b_id, a_lock,
+                                                    b_lock);
+
+    for (auto [id, set_pointer] : {make_pair(a_id, a_set_pointer),
+                                   make_pair(b_id, b_set_pointer)}) {
+        if (not exists_in_table(set_pointer)) {
+            DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                       " does not exist");
+
+            return false;
+        }
+    }
+
+    if (a_id == b_id)
+        return true;
+
+    auto exchanged = try_modify(function_name, b_id, [&] {
+        b_set_pointer->swap_contents(*a_set_pointer);
+        return true;
+    });
+    if (not exchanged)
+        return false;
+
+    if (clear_a)
+        a_set_pointer->clear();
+
+    return true;
+}
+
+// Set algebra keeps views of the cyphers of its operands, which compacted
+// sets cannot give out: those are expanded into scratch first.
+const set_t &expanded(const set_t &set, set_t &scratch) {
+    if (not set.compacted())
+        return set;
+
+    scratch.share(set);
+    scratch.expand();
+    return scratch;
+}
+
+// Shared body of encstrset_union, encstrset_intersect and
+// encstrset_difference: replaces the contents of dst with operation(a, b).
+template<typename Operation>
+void apply_set_operation(const debug_message_t &function_name,
+                         identifier_t dst_id, identifier_t a_id,
+                         identifier_t b_id, const debug_message_t &result_name,
+                         Operation operation) {
+    DEBUG_INFO(function_name + "(" + to_string(dst_id) + ", " +
+               to_string(a_id) + ", " + to_string(b_id) + ")");
+
+    group_lock_t locks;
+    lock_group(dst_id, {a_id, b_id}, locks);
+
+    for (auto id : {dst_id, a_id, b_id}) {
+        if (not exists_in_table(resolve_set(id))) {
+            DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                       " does not exist");
+
+            return;
+        }
+    }
+
+    // The result is built before dst is touched.
+    set_t a_scratch, b_scratch;
+    auto applied = try_modify(function_name, dst_id, [&] {
+        resolve_set(dst_id)->replace_contents(
+            operation(expanded(*resolve_set(a_id), a_scratch),
+                      expanded(*resolve_set(b_id), b_scratch)));
+        return true;
+    });
+    if (not applied)
+        return;
+
+    DEBUG_INFO(function_name + ": set #" + to_string(dst_id) +
+               " holds the " + result_name + " of sets #" + to_string(a_id) +
+               " and #" + to_string(b_id));
+}
+
+bool insert_value(const debug_message_t &function_name, identifier_t id,
+                  value_argument_t value, size_t value_length,
+                  const key_stream_t &key) {
+    DEBUG_INFO(function_name + "(" + to_string(id) + ", " +
+               quoted(value, value_length) + ", " +
+               quoted(key.data, key.key_length) + ")");
+
+    if (!value) {
+        DEBUG_INFO(function_name + ": invalid value (NULL)");
+
+        return false;
+    }
+
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                   " does not exist");
+
+        return false;
+    }
+
+    value_t cypher;
+    cyphering(value, value_length, key, cypher);
+
+    auto inserted = try_modify(function_name, id, [&] {
+        return set_pointer->insert(cypher);
+    });
+    if (not inserted)
+        return false;
+
+    if (*inserted) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) + ", cypher \"" +
+                   string_to_hex(cypher) + "\" inserted");
+
+        return true;
+    }
+    else {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) + ", cypher \"" +
+                   string_to_hex(cypher) + "\" was already present");
+
+        return false;
+    }
+}
+
+bool remove_value(const debug_message_t &function_name, identifier_t id,
+                  value_argument_t value, size_t value_length,
+                  const key_stream_t &key) {
+    DEBUG_INFO(function_name + "(" + to_string(id) + ", " +
+               quoted(value, value_length) + ", " +
+               quoted(key.data, key.key_length) + ")");
+
+    if (!value) {
+        DEBUG_INFO(function_name + ": invalid value (NULL)");
+
+        return false;
+    }
+
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                   " does not exist");
+
+        return false;
+    }
+
+    value_t cypher;
+    cyphering(value, value_length, key, cypher);
+
+    auto removed = try_modify(function_name, id, [&] {
+        return set_pointer->erase(cypher);
+    });
+    if (not removed)
+        return false;
+
+    if (*removed) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) + ", cypher \"" +
+                   string_to_hex(cypher) + "\" removed");
+
+        return true;
+    }
+    else {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) + ", cypher \"" +
+                   string_to_hex(cypher) + "\" was not present");
+
+        return false;
+    }
+}
+
+bool test_value(const debug_message_t &function_name, identifier_t id,
+                value_argument_t value, size_t value_length,
+                const key_stream_t &key) {
+    DEBUG_INFO(function_name + "(" + to_string(id) + ", " +
+               quoted(value, value_length) + ", " +
+               quoted(key.data, key.key_length) + ")");
+
+    if (!value) {
+        DEBUG_INFO(function_name + ": invalid value (NULL)");
+
+        return false;
+    }
+
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) +
+                   " does not exist");
+
+        return false;
+    }
+
+    // Reusing a per-thread buffer keeps lookups free of allocations.
+    thread_local value_t cypher;
+    cyphering(value, value_length, key, cypher);
+
+    if (set_pointer->contains(cypher)) {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) + ", cypher \"" +
+                   string_to_hex(cypher) + "\" is present");
+
+        return true;
+    }
+    else {
+        DEBUG_INFO(function_name + ": set #" + to_string(id) + ", cypher \"" +
+                   string_to_hex(cypher) + "\" is not present");
+
+        return false;
+    }
 }
 
-debug_message_t string_to_hex(const value_t &cypher) {
-    stringstream stream;
-    for (auto c : cypher)
-        stream << setw(2) << setfill('0') << uppercase << hex
-               << static_cast<int>(static_cast<unsigned char>(c)) << ' ';
+}  // namespace
+
+namespace jnp1 {
 
-    auto hex_string = stream.str();
-    if (not hex_string.empty())
-        hex_string.pop_back();
+// A key expanded once into its stream, so that repeated operations with the
+// same key skip the expansion.
+struct encstrset_key {
+    value_t bytes;
+    key_stream_t stream;
+};
 
-    return hex_string;
-}
+// Cursors walk a share of the table, a null one for an empty set.
+struct encstrset_cursor {
+    shared_ptr<const cypher_table> table;
+    size_t position = 0;
+};
 
-value_t cyphering(value_argument_t value, key_argument_t key) {
-    value_t cypher = value;
-    size_t value_length = !key ? strlen(value) : (size_t)0;
-    size_t key_length = !key ? strlen(key) : (size_t)0;
+identifier_t encstrset_new() {
+    DEBUG_INFO("encstrset_new()");
 
-    if (key_length == 0)
-        return cypher;
+    auto id = create_set();
 
-    for (size_t i = 0; i < value_length; i++)
-        cypher[i] = (value[i] ^ key[i % key_length]);
+    if (id == ENCSTRSET_INVALID_ID) {
+        DEBUG_INFO("encstrset_new: no more sets can be created");
 
-    return cypher;
-}
+        return id;
+    }
 
-bool exists_in_map(const map_t::iterator &set_pointer) {
-    return set_pointer != map_of_sets().end();
-}
+    DEBUG_INFO("encstrset_new: set #" + to_string(id) + " created");
 
-bool exists_in_set(const set_t::iterator &element_pointer,
-                   const map_t::iterator &set_pointer) {
-    return element_pointer != set_pointer->second.end();
+    return id;
 }
 
-}  // namespace
+identifier_t encstrset_new_ordered() {
+    DEBUG_INFO("encstrset_new_ordered()");
 
-namespace jnp1 {
+    set_t set;
+    set.enable_order();
+    auto id = create_set(move(set));
 
-identifier_t encstrset_new() {
-    debug_info("encstrset_new()");
+    if (id == ENCSTRSET_INVALID_ID) {
+        DEBUG_INFO("encstrset_new_ordered: no more sets can be created");
 
-    set_t new_set;
-    map_of_sets()[number_of_created_sets()] = new_set;
+        return id;
+    }
 
-    debug_info("encstrset_new: set #" + to_string(number_of_created_sets()) +
+    DEBUG_INFO("encstrset_new_ordered: set #" + to_string(id) +
                " created");
 
-    return number_of_created_sets()++;
+    return id;
 }
 
 void encstrset_delete(identifier_t id) {
-    debug_info("encstrset_delete(" + to_string(id) + ")");
+    DEBUG_INFO("encstrset_delete(" + to_string(id) + ")");
 
-    auto set_pointer = map_of_sets().find(id);
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
 
-    if (exists_in_map(set_pointer)) {
-        map_of_sets().erase(set_pointer);
-        debug_info("encstrset_delete: set #" + to_string(id) + " deleted");
+    if (exists_in_table(set_pointer)) {
+        bool reusable = destroy_set(id);
+        lock.unlock();
+        if (reusable)
+            recycle_slot(id);
+
+        DEBUG_INFO("encstrset_delete: set #" + to_string(id) + " deleted");
     }
     else
-        debug_info("encstrset_delete: set #" + to_string(id) +
+        DEBUG_INFO("encstrset_delete: set #" + to_string(id) +
                    " does not exist");
 }
 
 size_t encstrset_size(identifier_t id) {
-    debug_info("encstrset_size(" + to_string(id) + ")");
+    DEBUG_INFO("encstrset_size(" + to_string(id) + ")");
 
-    auto set_pointer = map_of_sets().find(id);
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
 
-    if (exists_in_map(set_pointer)) {
-        size_t size = set_pointer->second.size();
+    if (exists_in_table(set_pointer)) {
+        size_t size = set_pointer->size();
 
-        debug_info("encstrset_size: set #" + to_string(id) + " contains " +
+        DEBUG_INFO("encstrset_size: set #" + to_string(id) + " contains " +
                    to_string(size) + " element(s)");
 
         return size;
     }
     else {
-        debug_info("encstrset_size: set #" + to_string(id) + " does not exist");
+        DEBUG_INFO("encstrset_size: set #" + to_string(id) + " does not exist");
 
         return 0;
     }
 }
 
-bool encstrset_insert(identifier_t id, value_argument_t value,
-                      key_argument_t key) {
-    debug_info("encstrset_insert(" + to_string(id) + ", \"" +
-               (value ? string(value) : "NULL") + "\", \"" +
-               (key ? string(key) : "NULL") + "\")");
+bool encstrset_reserve(identifier_t id, size_t n) {
+    DEBUG_INFO("encstrset_reserve(" + to_string(id) + ", " + to_string(n) +
+               ")");
 
-    if (!value) {
-        debug_info("encstrset_insert: invalid value (NULL)");
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_reserve: set #" + to_string(id) +
+                   " does not exist");
 
         return false;
     }
 
-    auto set_pointer = map_of_sets().find(id);
+    auto reserved = try_modify("encstrset_reserve", id, [&] {
+        set_pointer->reserve(n);
+        return true;
+    });
+    if (not reserved)
+        return false;
+
+    DEBUG_INFO("encstrset_reserve: set #" + to_string(id) + ", room for " +
+               to_string(n) + " element(s)");
+
+    return true;
+}
+
+bool encstrset_compact(identifier_t id) {
+    DEBUG_INFO("encstrset_compact(" + to_string(id) + ")");
 
-    if (not exists_in_map(set_pointer)) {
-        debug_info("encstrset_insert: set #" + to_string(id) +
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_compact: set #" + to_string(id) +
                    " does not exist");
 
         return false;
     }
 
-    auto cypher = cyphering(value, key);
-    auto element_pointer = set_pointer->second.find(cypher);
+    auto compacted = try_modify("encstrset_compact", id, [&] {
+        set_pointer->compact();
+        return true;
+    });
+    if (not compacted)
+        return false;
 
-    if (not exists_in_set(element_pointer, set_pointer)) {
-        set_pointer->second.insert(cypher);
+    DEBUG_INFO("encstrset_compact: set #" + to_string(id) + ", " +
+               to_string(set_pointer->size()) + " element(s) in " +
+               to_string(set_pointer->table_bytes() +
+                         set_pointer->payload_bytes()) + " byte(s)");
 
-        debug_info("encstrset_insert: set #" + to_string(id) + ", cypher \"" +
-                   string_to_hex(cypher) + "\" inserted");
+    return true;
+}
 
-        return true;
-    }
-    else {
-        debug_info("encstrset_insert: set #" + to_string(id) + ", cypher \"" +
-                   string_to_hex(cypher) + "\" was already present");
+bool encstrset_insert(identifier_t id, value_argument_t value,
+                      key_argument_t key) {
+    return insert_value("encstrset_insert", id, value, length_of(value),
+                        plain_key(key, length_of(key)));
+}
 
-        return false;
-    }
+bool encstrset_insert_n(identifier_t id, value_argument_t value,
+                        size_t value_length, key_argument_t key,
+                        size_t key_length) {
+    return insert_value("encstrset_insert_n", id, value, value_length,
+                        plain_key(key, key_length));
 }
 
 bool encstrset_remove(identifier_t id, value_argument_t value,
                       key_argument_t key) {
-    debug_info("encstrset_remove(" + to_string(id) + ", \"" +
-               (value ? string(value) : "NULL") + "\", \"" +
-               (key ? string(key) : "NULL") + "\")");
+    return remove_value("encstrset_remove", id, value, length_of(value),
+                        plain_key(key, length_of(key)));
+}
 
-    if (!value) {
-        debug_info("encstrset_remove: invalid value (NULL)");
+bool encstrset_remove_n(identifier_t id, value_argument_t value,
+                        size_t value_length, key_argument_t key,
+                        size_t key_length) {
+    return remove_value("encstrset_remove_n", id, value, value_length,
+                        plain_key(key, key_length));
+}
 
-        return false;
+bool encstrset_test(identifier_t id, value_argument_t value,
+                    key_argument_t key) {
+    return test_value("encstrset_test", id, value, length_of(value),
+                      plain_key(key, length_of(key)));
+}
+
+bool encstrset_test_n(identifier_t id, value_argument_t value,
+                      size_t value_length, key_argument_t key,
+                      size_t key_length) {
+    return test_value("encstrset_test_n", id, value, value_length,
+                      plain_key(key, key_length));
+}
+
+encstrset_key *encstrset_key_prepare_n(key_argument_t key, size_t key_length) {
+    DEBUG_INFO("encstrset_key_prepare_n(" + quoted(key, key_length) + ", " +
+               to_string(key_length) + ")");
+
+    auto prepared = new encstrset_key;
+    if (key) {
+        prepared->bytes = expand_key(key, key_length);
+        prepared->stream = {prepared->bytes.data(), key_length,
+                            prepared->bytes.size()};
+    }
+    else
+        prepared->stream = plain_key(nullptr, 0);
+
+    DEBUG_INFO("encstrset_key_prepare_n: key prepared, stream of " +
+               to_string(prepared->stream.length) + " byte(s)");
+
+    return prepared;
+}
+
+encstrset_key *encstrset_key_prepare(key_argument_t key) {
+    return encstrset_key_prepare_n(key, length_of(key));
+}
+
+void encstrset_key_release(encstrset_key *key) {
+    DEBUG_INFO("encstrset_key_release()");
+
+    delete key;
+}
+
+bool encstrset_insert_with_key(identifier_t id, value_argument_t value,
+                               const encstrset_key *key) {
+    return insert_value("encstrset_insert_with_key", id, value,
+                        length_of(value),
+                        key ? key->stream : plain_key(nullptr, 0));
+}
+
+bool encstrset_remove_with_key(identifier_t id, value_argument_t value,
+                               const encstrset_key *key) {
+    return remove_value("encstrset_remove_with_key", id, value,
+                        length_of(value),
+                        key ? key->stream : plain_key(nullptr, 0));
+}
+
+bool encstrset_test_with_key(identifier_t id, value_argument_t value,
+                             const encstrset_key *key) {
+    return test_value("encstrset_test_with_key", id, value, length_of(value),
+                      key ? key->stream : plain_key(nullptr, 0));
+}
+
+void encstrset_clear(identifier_t id) {
+    DEBUG_INFO("encstrset_clear(" + to_string(id) + ")");
+
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (exists_in_table(set_pointer)) {
+        set_pointer->clear();
+        DEBUG_INFO("encstrset_clear: set #" + to_string(id) + " cleared");
+    }
+    else {
+        DEBUG_INFO("encstrset_clear: set #" + to_string(id) +
+                   " does not exist");
     }
+}
+
+void encstrset_copy(identifier_t src_id, identifier_t dst_id) {
+    DEBUG_INFO("encstrset_copy(" + to_string(src_id) + ", " +
+               to_string(dst_id) + ")");
 
-    auto set_pointer = map_of_sets().find(id);
+    read_lock_t src_lock;
+    write_lock_t dst_lock;
+    set_t *src_set_pointer, *dst_set_pointer;
+
+    // Slots are always locked in index order, so that concurrent copies in
+    // opposite directions cannot deadlock.
+    if (slot_index(src_id) == slot_index(dst_id)) {
+        auto slot = handle_table().find(slot_index(dst_id));
+        if (slot)
+            dst_lock = write_lock_t(slot->mutex);
+
+        src_set_pointer = slot and holds_set(*slot, src_id) ? &slot->set
+                                                            : nullptr;
+        dst_set_pointer = slot and holds_set(*slot, dst_id) ? &slot->set
+                                                            : nullptr;
+    }
+    else if (slot_index(src_id) < slot_index(dst_id)) {
+        src_set_pointer = find_set(src_id, src_lock);
+        dst_set_pointer = find_set(dst_id, dst_lock);
+    }
+    else {
+        dst_set_pointer = find_set(dst_id, dst_lock);
+        src_set_pointer = find_set(src_id, src_lock);
+    }
 
-    if (not exists_in_map(set_pointer)) {
-        debug_info("encstrset_remove: set #" + to_string(id) +
+    if (not exists_in_table(src_set_pointer)) {
+        DEBUG_INFO("encstrset_copy: set #" + to_string(src_id) +
                    " does not exist");
 
-        return false;
+        return;
     }
+    if (not exists_in_table(dst_set_pointer)) {
+        DEBUG_INFO("encstrset_copy: set #" + to_string(dst_id) +
+                   " does not exist");
 
-    auto cypher = cyphering(value, key);
-    auto element_pointer = set_pointer->second.find(cypher);
+        return;
+    }
 
-    if (exists_in_set(element_pointer, set_pointer)) {
-        set_pointer->second.erase(element_pointer);
+    auto &dst_set = *dst_set_pointer;
+    bool shared = dst_set.size() == 0;
 
-        debug_info("encstrset_remove: set #" + to_string(id) + ", cypher \"" +
-                   string_to_hex(cypher) + "\" removed");
+    auto copied = try_modify("encstrset_copy", dst_id, [&] {
+        if (shared) {
+            dst_set.share(*src_set_pointer);
+            return true;
+        }
 
+        dst_set.merge(*src_set_pointer, [&](cypher_view_t element,
+                                            bool inserted) {
+            if (inserted) {
+                DEBUG_INFO("encstrset_copy: cypher \"" +
+                           string_to_hex(element) + "\" copied from set #" +
+                           to_string(src_id) + " to set #" +
+                           to_string(dst_id));
+            }
+            else {
+                DEBUG_INFO("encstrset_copy: copied cypher \"" +
+                           string_to_hex(element) +
+                           "\" was already present in set #" +
+                           to_string(dst_id));
+            }
+        });
         return true;
+    });
+
+    if (copied and shared and DEBUG)
+        src_set_pointer->for_each([&](cypher_view_t element) {
+            DEBUG_INFO("encstrset_copy: cypher \"" + string_to_hex(element) +
+                       "\" copied from set #" + to_string(src_id) +
+                       " to set #" + to_string(dst_id));
+        });
+}
+
+size_t encstrset_insert_batch(identifier_t id, values_argument_t values,
+                              size_t count, key_argument_t key,
+                              results_argument_t results) {
+    DEBUG_INFO(batch_call("encstrset_insert_batch", id, count) + ", " +
+               quoted(key) + ")");
+
+    return apply_batch<write_lock_t>("encstrset_insert_batch", id, values,
+                                     count, shared_key(key), results, count,
+                                     "inserted", insert_hashed);
+}
+
+size_t encstrset_insert_batch_keys(identifier_t id, values_argument_t values,
+                                   keys_argument_t keys, size_t count,
+                                   results_argument_t results) {
+    DEBUG_INFO(batch_call("encstrset_insert_batch_keys", id, count) + ")");
+
+    return apply_batch<write_lock_t>("encstrset_insert_batch_keys", id, values,
+                                     count, key_array(keys), results, count,
+                                     "inserted", insert_hashed);
+}
+
+size_t encstrset_remove_batch(identifier_t id, values_argument_t values,
+                              size_t count, key_argument_t key,
+                              results_argument_t results) {
+    DEBUG_INFO(batch_call("encstrset_remove_batch", id, count) + ", " +
+               quoted(key) + ")");
+
+    return apply_batch<write_lock_t>("encstrset_remove_batch", id, values,
+                                     count, shared_key(key), results, 0,
+                                     "removed", erase_hashed);
+}
+
+size_t encstrset_remove_batch_keys(identifier_t id, values_argument_t values,
+                                   keys_argument_t keys, size_t count,
+                                   results_argument_t results) {
+    DEBUG_INFO(batch_call("encstrset_remove_batch_keys", id, count) + ")");
+
+    return apply_batch<write_lock_t>("encstrset_remove_batch_keys", id, values,
+                                     count, key_array(keys), results, 0,
+                                     "removed", erase_hashed);
+}
+
+size_t encstrset_test_batch(identifier_t id, values_argument_t values,
+                            size_t count, key_argument_t key,
+                            results_argument_t results) {
+    DEBUG_INFO(batch_call("encstrset_test_batch", id, count) + ", " +
+               quoted(key) + ")");
+
+    return apply_batch<read_lock_t>("encstrset_test_batch", id, values, count,
+                                    shared_key(key), results, 0, "present",
+                                    contains_hashed);
+}
+
+size_t encstrset_test_batch_keys(identifier_t id, values_argument_t values,
+                                 keys_argument_t keys, size_t count,
+                                 results_argument_t results) {
+    DEBUG_INFO(batch_call("encstrset_test_batch_keys", id, count) + ")");
+
+    return apply_batch<read_lock_t>("encstrset_test_batch_keys", id, values,
+                                    count, key_array(keys), results, 0,
+                                    "present", contains_hashed);
+}
+
+size_t encstrset_scan_prefix(identifier_t id, value_argument_t prefix,
+                             key_argument_t key, visitor_argument_t visit,
+                             void *context) {
+    DEBUG_INFO("encstrset_scan_prefix(" + to_string(id) + ", " +
+               quoted(prefix) + ", " + quoted(key) + ")");
+
+    if (!prefix or !visit) {
+        DEBUG_INFO("encstrset_scan_prefix: invalid prefix or visitor (NULL)");
+
+        return 0;
     }
-    else {
-        debug_info("encstrset_remove: set #" + to_string(id) + ", cypher \"" +
-                   string_to_hex(cypher) + "\" was not present");
 
-        return false;
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_scan_prefix: set #" + to_string(id) +
+                   " does not exist");
+
+        return 0;
     }
+
+    value_t cypher;
+    cyphering(prefix, strlen(prefix), plain_key(key, length_of(key)), cypher);
+    size_t visited = set_pointer->scan_prefix(
+        cypher, [&](cypher_view_t found) {
+            return visit(found.data(), found.size(), context);
+        });
+
+    DEBUG_INFO("encstrset_scan_prefix: set #" + to_string(id) + ", " +
+               to_string(visited) + " cypher(s) with prefix \"" +
+               string_to_hex(cypher) + "\" visited");
+
+    return visited;
 }
 
-bool encstrset_test(identifier_t id, value_argument_t value,
-                    key_argument_t key) {
-    debug_info("encstrset_test(" + to_string(id) + ", \"" +
-               (value ? string(value) : "NULL") + "\", \"" +
-               (key ? string(key) : "NULL") + "\")");
+size_t encstrset_test_sets(ids_argument_t ids, size_t count,
+                           value_argument_t value, key_argument_t key,
+                           bitmap_argument_t bitmap) {
+    DEBUG_INFO("encstrset_test_sets(" + to_string(count) + " set(s), " +
+               quoted(value) + ", " + quoted(key) + ")");
+
+    if (bitmap)
+        fill(bitmap, bitmap + (count + 7) / 8, 0);
 
     if (!value) {
-        debug_info("encstrset_test: invalid value (NULL)");
+        DEBUG_INFO("encstrset_test_sets: invalid value (NULL)");
 
-        return false;
+        return 0;
+    }
+
+    if (!ids and count > 0) {
+        DEBUG_INFO("encstrset_test_sets: invalid ids (NULL)");
+
+        return 0;
     }
 
-    auto set_pointer = map_of_sets().find(id);
+    thread_local value_t cypher;
+    cyphering(value, strlen(value), plain_key(key, length_of(key)), cypher);
+    size_t found = contained_in_sets(ids, count, cypher, set_t::hash_of(cypher),
+                                     bitmap);
+
+    DEBUG_INFO("encstrset_test_sets: cypher \"" + string_to_hex(cypher) +
+               "\" is present in " + to_string(found) + " of " +
+               to_string(count) + " set(s)");
+
+    return found;
+}
+
+void encstrset_move(identifier_t src_id, identifier_t dst_id) {
+    if (exchange_contents("encstrset_move", src_id, dst_id, true))
+        DEBUG_INFO("encstrset_move: contents of set #" + to_string(src_id) +
+                   " moved to set #" + to_string(dst_id));
+}
+
+void encstrset_swap(identifier_t a_id, identifier_t b_id) {
+    if (exchange_contents("encstrset_swap", a_id, b_id, false))
+        DEBUG_INFO("encstrset_swap: contents of sets #" + to_string(a_id) +
+                   " and #" + to_string(b_id) + " swapped");
+}
+
+void encstrset_union(identifier_t dst_id, identifier_t a_id,
+                     identifier_t b_id) {
+    apply_set_operation("encstrset_union", dst_id, a_id, b_id, "union",
+                        union_of);
+}
+
+void encstrset_intersect(identifier_t dst_id, identifier_t a_id,
+                         identifier_t b_id) {
+    apply_set_operation("encstrset_intersect", dst_id, a_id, b_id,
+                        "intersection", intersection_of);
+}
+
+void encstrset_difference(identifier_t dst_id, identifier_t a_id,
+                          identifier_t b_id) {
+    apply_set_operation("encstrset_difference", dst_id, a_id, b_id,
+                        "difference", difference_of);
+}
+
+bool encstrset_save(identifier_t id, path_argument_t path) {
+    DEBUG_INFO("encstrset_save(" + to_string(id) + ", " + quoted(path) + ")");
 
-    if (not exists_in_map(set_pointer)) {
-        debug_info("encstrset_test: set #" + to_string(id) + " does not exist");
+    if (!path) {
+        DEBUG_INFO("encstrset_save: invalid path (NULL)");
 
         return false;
     }
 
-    auto cypher = cyphering(value, key);
-    auto element_pointer = set_pointer->second.find(cypher);
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
 
-    if (exists_in_set(element_pointer, set_pointer)) {
-        debug_info("encstrset_test: set #" + to_string(id) + ", cypher \"" +
-                   string_to_hex(cypher) + "\" is present");
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_save: set #" + to_string(id) + " does not exist");
+
+        return false;
+    }
+
+    if (save_snapshot(*set_pointer, path)) {
+        DEBUG_INFO("encstrset_save: set #" + to_string(id) + " saved to \"" +
+                   path + "\"");
 
         return true;
     }
     else {
-        debug_info("encstrset_test: set #" + to_string(id) + ", cypher \"" +
-                   string_to_hex(cypher) + "\" is not present");
+        DEBUG_INFO("encstrset_save: set #" + to_string(id) +
+                   " could not be saved to \"" + path + "\"");
 
         return false;
     }
 }
 
-void encstrset_clear(identifier_t id) {
-    debug_info("encstrset_clear(" + to_string(id) + ")");
+identifier_t encstrset_load(path_argument_t path) {
+    DEBUG_INFO("encstrset_load(" + quoted(path) + ")");
 
-    auto set_pointer = map_of_sets().find(id);
+    if (!path) {
+        DEBUG_INFO("encstrset_load: invalid path (NULL)");
 
-    if (exists_in_map(set_pointer)) {
-        set_pointer->second.clear();
-        debug_info("encstrset_clear: set #" + to_string(id) + " cleared");
+        return ENCSTRSET_INVALID_ID;
     }
-    else {
-        debug_info("encstrset_clear: set #" + to_string(id) +
+
+    auto table = map_snapshot(path);
+
+    if (not table) {
+        DEBUG_INFO("encstrset_load: \"" + string(path) +
+                   "\" is not a valid snapshot");
+
+        return ENCSTRSET_INVALID_ID;
+    }
+
+    set_t set;
+    set.adopt(move(table));
+    auto id = create_set(move(set));
+
+    if (id == ENCSTRSET_INVALID_ID) {
+        DEBUG_INFO("encstrset_load: no more sets can be created");
+
+        return id;
+    }
+
+    DEBUG_INFO("encstrset_load: set #" + to_string(id) + " loaded from \"" +
+               path + "\"");
+
+    return id;
+}
+
+encstrset_cursor *encstrset_cursor_open(identifier_t id) {
+    DEBUG_INFO("encstrset_cursor_open(" + to_string(id) + ")");
+
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_cursor_open: set #" + to_string(id) +
                    " does not exist");
+
+        return nullptr;
     }
+
+    // A compacted set is expanded for the cursor.
+    shared_ptr<const cypher_table> table;
+    auto opened = try_modify("encstrset_cursor_open", id, [&] {
+        table = set_pointer->table();
+        return true;
+    });
+    if (not opened)
+        return nullptr;
+
+    auto cursor = new encstrset_cursor;
+    cursor->table = move(table);
+
+    DEBUG_INFO("encstrset_cursor_open: set #" + to_string(id) +
+               ", cursor over " + to_string(set_pointer->size()) +
+               " element(s)");
+
+    return cursor;
 }
 
-void encstrset_copy(identifier_t src_id, identifier_t dst_id) {
-    debug_info("encstrset_copy(" + to_string(src_id) + ", " +
-               to_string(dst_id) + ")");
+bool encstrset_cursor_next(encstrset_cursor *cursor, const char **cypher,
+                           size_t *length) {
+    cypher_view_t found;
+    if (not cursor or not cursor->table or
+        not cursor->table->next(cursor->position, found))
+        return false;
+
+    if (cypher)
+        *cypher = found.data();
+    if (length)
+        *length = found.size();
 
-    auto src_set_pointer = map_of_sets().find(src_id);
-    auto dst_set_pointer = map_of_sets().find(dst_id);
+    return true;
+}
+
+void encstrset_cursor_close(encstrset_cursor *cursor) {
+    DEBUG_INFO("encstrset_cursor_close()");
+
+    delete cursor;
+}
 
-    if (not exists_in_map(src_set_pointer)) {
-        debug_info("encstrset_copy: set #" + to_string(src_id) +
+size_t encstrset_export(identifier_t id, char *buffer, size_t buffer_size) {
+    DEBUG_INFO("encstrset_export(" + to_string(id) + ", " +
+               to_string(buffer_size) + ")");
+
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_export: set #" + to_string(id) +
                    " does not exist");
 
-        return;
+        return 0;
     }
-    if (not exists_in_map(dst_set_pointer)) {
-        debug_info("encstrset_copy: set #" + to_string(dst_id) +
+
+    size_t needed = 0;
+    set_pointer->for_each([&](cypher_view_t cypher) {
+        needed += sizeof(size_t) + cypher.size();
+    });
+
+    if (!buffer or buffer_size < needed) {
+        DEBUG_INFO("encstrset_export: set #" + to_string(id) + ", " +
+                   to_string(needed) + " byte(s) needed");
+
+        return needed;
+    }
+
+    char *end = buffer;
+    set_pointer->for_each([&](cypher_view_t cypher) {
+        size_t length = cypher.size();
+        memcpy(end, &length, sizeof(length));
+        memcpy(end + sizeof(length), cypher.data(), length);
+        end += sizeof(length) + length;
+    });
+
+    DEBUG_INFO("encstrset_export: set #" + to_string(id) + ", " +
+               to_string(needed) + " byte(s) exported");
+
+    return needed;
+}
+
+size_t encstrset_memory_usage(identifier_t id, encstrset_memory *usage) {
+    DEBUG_INFO("encstrset_memory_usage(" + to_string(id) + ")");
+
+    if (usage)
+        *usage = encstrset_memory{};
+
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_memory_usage: set #" + to_string(id) +
                    " does not exist");
 
-        return;
+        return 0;
     }
 
-    for (const auto &element : src_set_pointer->second) {
-        auto element_pointer = dst_set_pointer->second.find(element);
+    encstrset_memory found{set_pointer->table_bytes(),
+                           set_pointer->node_bytes(),
+                           set_pointer->payload_bytes()};
+    if (usage)
+        *usage = found;
 
-        if (not exists_in_set(element_pointer, dst_set_pointer)) {
-            dst_set_pointer->second.insert(element);
-            debug_info("encstrset_copy: cypher \"" + string_to_hex(element) +
-                       "\" copied from set #" + to_string(src_id) +
-                       " to set #" + to_string(dst_id));
-        }
-        else {
-            debug_info("encstrset_copy: copied cypher \"" +
-                       string_to_hex(element) +
-                       "\" was already present in set #" + to_string(dst_id));
-        }
+    size_t total = found.table + found.nodes + found.payload;
+    DEBUG_INFO("encstrset_memory_usage: set #" + to_string(id) + " uses " +
+               to_string(total) + " byte(s), " + to_string(found.table) +
+               " for the table, " + to_string(found.nodes) +
+               " for the nodes, " + to_string(found.payload) +
+               " for the payload");
+
+    return total;
+}
+
+bool encstrset_use_allocator(identifier_t id,
+                             const encstrset_allocator *allocator) {
+    DEBUG_INFO("encstrset_use_allocator(" + to_string(id) + ", " +
+               (allocator ? "custom" : "NULL") + ")");
+
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_use_allocator: set #" + to_string(id) +
+                   " does not exist");
+
+        return false;
+    }
+
+    allocator_hooks_t hooks;
+    if (allocator)
+        hooks = {allocator->allocate, allocator->release, allocator->context};
+
+    auto moved = try_modify("encstrset_use_allocator", id, [&] {
+        set_pointer->use_allocator(hooks);
+        return true;
+    });
+    if (not moved)
+        return false;
+
+    DEBUG_INFO("encstrset_use_allocator: set #" + to_string(id) + ", " +
+               (allocator ? "custom" : "default") + " allocator in use");
+
+    return true;
+}
+
+void encstrset_debug_flush() {
+    if (DEBUG)
+        debug_sink().flush();
+}
+
+bool encstrset_use_bloom(identifier_t id, bool enabled) {
+    DEBUG_INFO("encstrset_use_bloom(" + to_string(id) + ", " +
+               (enabled ? "true" : "false") + ")");
+
+    write_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_use_bloom: set #" + to_string(id) +
+                   " does not exist");
+
+        return false;
+    }
+
+    if (enabled)
+        set_pointer->enable_bloom();
+    else
+        set_pointer->disable_bloom();
+
+    DEBUG_INFO("encstrset_use_bloom: set #" + to_string(id) +
+               ", Bloom filter " + (enabled ? "enabled" : "disabled"));
+
+    return true;
+}
+
+bool encstrset_bloom_stats(identifier_t id, double *observed_rate,
+                           double *expected_rate) {
+    DEBUG_INFO("encstrset_bloom_stats(" + to_string(id) + ")");
+
+    read_lock_t lock;
+    auto set_pointer = find_set(id, lock);
+
+    if (not exists_in_table(set_pointer)) {
+        DEBUG_INFO("encstrset_bloom_stats: set #" + to_string(id) +
+                   " does not exist");
+
+        return false;
     }
+
+    auto bloom = set_pointer->bloom();
+
+    if (not bloom) {
+        DEBUG_INFO("encstrset_bloom_stats: set #" + to_string(id) +
+                   " has no Bloom filter");
+
+        return false;
+    }
+
+    auto observed = bloom->observed_false_positive_rate();
+    auto expected = bloom->expected_false_positive_rate();
+    if (observed_rate)
+        *observed_rate = observed;
+    if (expected_rate)
+        *expected_rate = expected;
+
+    DEBUG_INFO("encstrset_bloom_stats: set #" + to_string(id) +
+               ", false positive rate " + to_string(observed) +
+               " observed, " + to_string(expected) + " expected");
+
+    return true;
 }
 
 }  // namespace jnp1
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef ENCSTRSET_H
 #define ENCSTRSET_H
 
+/* Never returned as the id of an existing set. */
+#define ENCSTRSET_INVALID_ID ((unsigned long)-1)
+
 #ifdef __cplusplus
 #include <iostream>
 #include <cstddef>
@@ -17,20 +20,200 @@ extern "C" {
 
         unsigned long encstrset_new();
 
+        /* Ordered sets also answer encstrset_scan_prefix quickly. */
+        unsigned long encstrset_new_ordered();
+
         void encstrset_delete(unsigned long id);
 
         size_t encstrset_size(unsigned long id);
 
+        bool encstrset_reserve(unsigned long id, size_t n);
+
+        /*
+         * Freezes the set into a sorted, front-coded form that takes a
+         * fraction of the memory and still answers encstrset_test and
+         * encstrset_scan_prefix quickly. The first modification of the set
+         * turns it back into an ordinary one.
+         */
+        bool encstrset_compact(unsigned long id);
+
         bool encstrset_insert(unsigned long id, const char *value, const char *key);
 
         bool encstrset_remove(unsigned long id, const char *value, const char *key);
 
         bool encstrset_test(unsigned long id, const char *value, const char *key);
 
+        bool encstrset_insert_n(unsigned long id, const char *value,
+                                size_t value_length, const char *key,
+                                size_t key_length);
+
+        bool encstrset_remove_n(unsigned long id, const char *value,
+                                size_t value_length, const char *key,
+                                size_t key_length);
+
+        bool encstrset_test_n(unsigned long id, const char *value,
+                              size_t value_length, const char *key,
+                              size_t key_length);
+
+        /* Key expanded once for repeated use; NULL stands for no key. */
+        struct encstrset_key;
+
+        struct encstrset_key *encstrset_key_prepare(const char *key);
+
+        struct encstrset_key *encstrset_key_prepare_n(const char *key,
+                                                      size_t key_length);
+
+        void encstrset_key_release(struct encstrset_key *key);
+
+        bool encstrset_insert_with_key(unsigned long id, const char *value,
+                                       const struct encstrset_key *key);
+
+        bool encstrset_remove_with_key(unsigned long id, const char *value,
+                                       const struct encstrset_key *key);
+
+        bool encstrset_test_with_key(unsigned long id, const char *value,
+                                     const struct encstrset_key *key);
+
         void encstrset_clear(unsigned long id);
 
         void encstrset_copy(unsigned long src_id, unsigned long dst_id);
 
+        /* Both take constant time for sets with the same allocator. */
+        void encstrset_move(unsigned long src_id, unsigned long dst_id);
+
+        void encstrset_swap(unsigned long a_id, unsigned long b_id);
+
+        size_t encstrset_insert_batch(unsigned long id,
+                                      const char *const *values, size_t count,
+                                      const char *key, bool *results);
+
+        size_t encstrset_insert_batch_keys(unsigned long id,
+                                           const char *const *values,
+                                           const char *const *keys,
+                                           size_t count, bool *results);
+
+        size_t encstrset_remove_batch(unsigned long id,
+                                      const char *const *values, size_t count,
+                                      const char *key, bool *results);
+
+        size_t encstrset_remove_batch_keys(unsigned long id,
+                                           const char *const *values,
+                                           const char *const *keys,
+                                           size_t count, bool *results);
+
+        size_t encstrset_test_batch(unsigned long id,
+                                    const char *const *values, size_t count,
+                                    const char *key, bool *results);
+
+        size_t encstrset_test_batch_keys(unsigned long id,
+                                         const char *const *values,
+                                         const char *const *keys,
+                                         size_t count, bool *results);
+
+        /*
+         * Calls visit with every cypher that starts with the cypher of
+         * prefix, until it returns false, and returns the number of calls.
+         * Cyphers come in byte order from ordered sets, which take time
+         * proportional to the matches; other sets are scanned in full. The
+         * set is locked during the scan, so visit must not modify it.
+         */
+        size_t encstrset_scan_prefix(unsigned long id, const char *prefix,
+                                     const char *key,
+                                     bool (*visit)(const char *cypher,
+                                                   size_t length,
+                                                   void *context),
+                                     void *context);
+
+        /* Sets bit i % 8 of bitmap[i / 8] iff set ids[i] contains value. */
+        size_t encstrset_test_sets(const unsigned long *ids, size_t count,
+                                   const char *value, const char *key,
+                                   unsigned char *bitmap);
+
+        void encstrset_union(unsigned long dst_id, unsigned long a_id,
+                             unsigned long b_id);
+
+        void encstrset_intersect(unsigned long dst_id, unsigned long a_id,
+                                 unsigned long b_id);
+
+        void encstrset_difference(unsigned long dst_id, unsigned long a_id,
+                                  unsigned long b_id);
+
+        bool encstrset_save(unsigned long id, const char *path);
+
+        unsigned long encstrset_load(const char *path);
+
+        /*
+         * A cursor yields the cyphers of a set as they are stored, without
+         * copying them. It works on the contents the set had when the
+         * cursor was opened: modifying the set afterwards makes the set
+         * copy its contents first, and does not affect the cursor. The
+         * pointers stay valid until the cursor is closed, even if the set
+         * is deleted in the meantime. Opening a cursor on a compacted set
+         * expands a copy of it, and returns NULL when there is no memory
+         * for that.
+         */
+        struct encstrset_cursor;
+
+        struct encstrset_cursor *encstrset_cursor_open(unsigned long id);
+
+        bool encstrset_cursor_next(struct encstrset_cursor *cursor,
+                                   const char **cypher, size_t *length);
+
+        void encstrset_cursor_close(struct encstrset_cursor *cursor);
+
+        /*
+         * Writes every cypher of the set as a size_t length followed by its
+         * bytes, with no alignment. Returns the number of bytes this takes;
+         * nothing is written when buffer is NULL or smaller than that.
+         */
+        size_t encstrset_export(unsigned long id, char *buffer,
+                                size_t buffer_size);
+
+        /*
+         * Bytes held by a set. Tables and trees shared with other sets,
+         * see encstrset_copy, are counted in full by each of them.
+         */
+        struct encstrset_memory {
+            size_t table;   /* hash slots */
+            size_t nodes;   /* per-set bookkeeping and the Bloom filter */
+            size_t payload; /* cypher bytes, including erased ones */
+        };
+
+        size_t encstrset_memory_usage(unsigned long id,
+                                      struct encstrset_memory *usage);
+
+        /*
+         * Memory for the slots and cypher bytes of a set is taken from
+         * allocate and given back to release. Three parts of a set stay
+         * on malloc: the contents of a compacted set until it is expanded,
+         * the tree of an ordered set, which holds a second copy of every
+         * cypher, and the Bloom filter. allocate and release may be called
+         * concurrently for different sets. When allocate returns NULL, the
+         * operation that needed the memory fails and leaves the set as it
+         * was. A NULL allocator restores malloc and free. Memory is given
+         * back at the latest when the set is deleted and no other set or
+         * cursor shares its contents.
+         */
+        struct encstrset_allocator {
+            void *(*allocate)(size_t size, void *context);
+            void (*release)(void *memory, size_t size, void *context);
+            void *context;
+        };
+
+        bool encstrset_use_allocator(
+            unsigned long id, const struct encstrset_allocator *allocator);
+
+        /*
+         * Diagnostics are written by a background thread, and at the
+         * latest at exit. Writes out the ones issued so far.
+         */
+        void encstrset_debug_flush();
+
+        bool encstrset_use_bloom(unsigned long id, bool enabled);
+
+        bool encstrset_bloom_stats(unsigned long id, double *observed_rate,
+                                   double *expected_rate);
+
 #ifdef __cplusplus
     }
 }
@@ -0,0 +1,509 @@
+#include "encstrset.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Microbenchmarks of the public API. Every measurement is printed as one
+ * JSON object per line. Debug builds write each diagnostic to stderr, so
+ * run them with --quick and stderr redirected.
+ */
+
+struct config {
+    const char *benchmark;
+    size_t set_size;
+    size_t value_length;
+    size_t key_length;
+    unsigned hit_percent;
+    size_t threads;
+};
+
+static int quick = 0;
+
+#ifdef NDEBUG
+static const char *build = "release";
+#else
+static const char *build = "debug";
+#endif
+
+#ifdef ENCSTRSET_CONCURRENT
+static const char *concurrent = "true";
+#else
+static const char *concurrent = "false";
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count,
+                           unsigned per_mille) {
+    size_t rank = count * per_mille / 1000;
+
+    return sorted[rank < count ? rank : count - 1];
+}
+
+/* Sorts the latencies of ops operations taking elapsed ns in total. */
+static void report(const struct config *config, const char *operation,
+                   uint64_t *latencies, size_t ops, uint64_t elapsed) {
+    if (ops == 0)
+        return;
+
+    qsort(latencies, ops, sizeof(*latencies), compare_latencies);
+    printf("{\"benchmark\": \"%s\", \"operation\": \"%s\", "
+           "\"build\": \"%s\", \"concurrent\": %s, \"threads\": %zu, "
+           "\"set_size\": %zu, \"value_length\": %zu, "
+           "\"key_length\": %zu, \"hit_ratio\": %.2f, \"ops\": %zu, "
+           "\"ops_per_sec\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+           "\"p999_ns\": %llu, \"max_ns\": %llu}\n",
+           config->benchmark, operation, build, concurrent, config->threads,
+           config->set_size, config->value_length, config->key_length,
+           config->hit_percent / 100.0, ops,
+           ops / (elapsed > 0 ? elapsed / 1e9 : 1e-9),
+           (unsigned long long)percentile(latencies, ops, 500),
+           (unsigned long long)percentile(latencies, ops, 990),
+           (unsigned long long)percentile(latencies, ops, 999),
+           (unsigned long long)latencies[ops - 1]);
+    fflush(stdout);
+}
+
+/*
+ * count distinct values of the given length, at least 8, each holding its
+ * index after tag. Values with different tags never collide.
+ */
+static char **make_values(char tag, size_t count, size_t length) {
+    char *buffer = malloc(count * (length + 1));
+    char **values = malloc(count * sizeof(char *));
+
+    for (size_t i = 0; i < count; i++) {
+        char *value = buffer + i * (length + 1);
+        int written = snprintf(value, length + 1, "%c%zu", tag, i);
+
+        memset(value + written, 'x', length - written);
+        value[length] = '\0';
+        values[i] = value;
+    }
+
+    return values;
+}
+
+static void free_values(char **values) {
+    free(values[0]);
+    free(values);
+}
+
+static char *make_key(size_t length) {
+    char *key = malloc(length + 1);
+
+    for (size_t i = 0; i < length; i++)
+        key[i] = (char)('A' + i % 26);
+    key[length] = '\0';
+
+    return key;
+}
+
+/* Lookups of config->set_size values, config->hit_percent of them hits. */
+static void bench_tests(const struct config *config, const char *operation,
+                        unsigned long set, char **values, char **misses,
+                        const char *key, uint64_t *latencies) {
+    size_t count = config->set_size;
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < count; i++) {
+        const char *value = i % 100 < config->hit_percent ? values[i]
+                                                          : misses[i];
+        uint64_t begin = now_ns();
+        encstrset_test(set, value, key);
+        latencies[i] = now_ns() - begin;
+    }
+    report(config, operation, latencies, count, now_ns() - start);
+}
+
+/* insert, test, copy, clear and remove on one set of config->set_size. */
+static void bench_operations(const struct config *config) {
+    size_t count = config->set_size;
+    char **values = make_values('v', count, config->value_length);
+    char **misses = make_values('m', count, config->value_length);
+    char *key = make_key(config->key_length);
+    uint64_t *latencies = malloc(count * sizeof(uint64_t));
+    unsigned long set = encstrset_new();
+    unsigned long other = encstrset_new();
+    size_t repeats = count >= 100000 ? 3 : 20;
+    uint64_t start;
+
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = now_ns();
+        encstrset_insert(set, values[i], key);
+        latencies[i] = now_ns() - begin;
+    }
+    report(config, "insert", latencies, count, now_ns() - start);
+
+    bench_tests(config, "test", set, values, misses, key, latencies);
+
+    start = now_ns();
+    for (size_t i = 0; i < repeats; i++) {
+        uint64_t begin = now_ns();
+        encstrset_copy(set, other);
+        latencies[i] = now_ns() - begin;
+        encstrset_clear(other);
+    }
+    report(config, "copy_into_empty", latencies, repeats, now_ns() - start);
+
+    start = now_ns();
+    for (size_t i = 0; i < repeats; i++) {
+        encstrset_insert(other, misses[0], key);
+        uint64_t begin = now_ns();
+        encstrset_copy(set, other);
+        latencies[i] = now_ns() - begin;
+        encstrset_clear(other);
+    }
+    report(config, "copy_into_nonempty", latencies, repeats,
+           now_ns() - start);
+
+    encstrset_copy(set, other);
+    encstrset_insert(other, misses[0], key);
+    start = now_ns();
+    encstrset_clear(other);
+    latencies[0] = now_ns() - start;
+    report(config, "clear", latencies, 1, latencies[0]);
+
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = now_ns();
+        encstrset_remove(set, values[i], key);
+        latencies[i] = now_ns() - begin;
+    }
+    report(config, "remove", latencies, count, now_ns() - start);
+
+    encstrset_delete(set);
+    encstrset_delete(other);
+    free(latencies);
+    free(key);
+    free_values(misses);
+    free_values(values);
+}
+
+static void report_memory(const struct config *config, const char *operation,
+                          unsigned long set) {
+    size_t bytes = encstrset_memory_usage(set, NULL);
+
+    printf("{\"benchmark\": \"%s\", \"operation\": \"%s\", "
+           "\"build\": \"%s\", \"set_size\": %zu, "
+           "\"value_length\": %zu, \"bytes\": %zu, "
+           "\"bytes_per_element\": %.1f}\n",
+           config->benchmark, operation, build, config->set_size,
+           config->value_length, bytes,
+           (double)bytes / (config->set_size > 0 ? config->set_size : 1));
+    fflush(stdout);
+}
+
+/* Memory use and lookups of one set, before and after encstrset_compact. */
+static void bench_compact(const struct config *config) {
+    size_t count = config->set_size;
+    char **values = make_values('v', count, config->value_length);
+    char **misses = make_values('m', count, config->value_length);
+    char *key = make_key(config->key_length);
+    uint64_t *latencies = malloc(count * sizeof(uint64_t));
+    unsigned long set = encstrset_new();
+    uint64_t start;
+
+    for (size_t i = 0; i < count; i++)
+        encstrset_insert(set, values[i], key);
+    report_memory(config, "memory", set);
+    bench_tests(config, "test", set, values, misses, key, latencies);
+
+    start = now_ns();
+    encstrset_compact(set);
+    latencies[0] = now_ns() - start;
+    report(config, "compact", latencies, 1, latencies[0]);
+
+    report_memory(config, "memory_compact", set);
+    bench_tests(config, "test_compact", set, values, misses, key, latencies);
+
+    encstrset_delete(set);
+    free(latencies);
+    free(key);
+    free_values(misses);
+    free_values(values);
+}
+
+/*
+ * Replaces every element of a set with a Bloom filter, one removal and one
+ * insert at a time. The removals make the filter stale and fill the arena
+ * with erased cyphers, so the latencies take in rebuilding the one and
+ * compacting the other.
+ */
+static void bench_churn(const struct config *config) {
+    size_t count = config->set_size;
+    char **values = make_values('v', count, config->value_length);
+    char **replacements = make_values('r', count, config->value_length);
+    char *key = make_key(config->key_length);
+    uint64_t *removals = malloc(count * sizeof(uint64_t));
+    uint64_t *inserts = malloc(count * sizeof(uint64_t));
+    unsigned long set = encstrset_new();
+    uint64_t removing = 0, inserting = 0;
+
+    for (size_t i = 0; i < count; i++)
+        encstrset_insert(set, values[i], key);
+    encstrset_use_bloom(set, true);
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = now_ns();
+        encstrset_remove(set, values[i], key);
+        uint64_t middle = now_ns();
+        encstrset_insert(set, replacements[i], key);
+        uint64_t end = now_ns();
+
+        removals[i] = middle - begin;
+        inserts[i] = end - middle;
+        removing += removals[i];
+        inserting += inserts[i];
+    }
+    report(config, "churn_remove", removals, count, removing);
+    report(config, "churn_insert", inserts, count, inserting);
+
+    encstrset_delete(set);
+    free(inserts);
+    free(removals);
+    free(key);
+    free_values(replacements);
+    free_values(values);
+}
+
+/* Creates config->set_size live sets, then deletes them. */
+static void bench_live_sets(const struct config *config) {
+    size_t count = config->set_size;
+    unsigned long *ids = malloc(count * sizeof(unsigned long));
+    uint64_t *latencies = malloc(count * sizeof(uint64_t));
+    uint64_t start;
+
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = now_ns();
+        ids[i] = encstrset_new();
+        latencies[i] = now_ns() - begin;
+    }
+    report(config, "new", latencies, count, now_ns() - start);
+
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = now_ns();
+        encstrset_test(ids[(i * 7919) % count], "value", "key");
+        latencies[i] = now_ns() - begin;
+    }
+    report(config, "test_across_sets", latencies, count, now_ns() - start);
+
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = now_ns();
+        encstrset_delete(ids[i]);
+        latencies[i] = now_ns() - begin;
+    }
+    report(config, "delete", latencies, count, now_ns() - start);
+
+    free(latencies);
+    free(ids);
+}
+
+struct worker {
+    unsigned long shared_set;
+    char **values;
+    char **misses;
+    const char *key;
+    size_t ops;
+    uint64_t *latencies;
+};
+
+/* Lookups in the shared set, half of them hits. */
+static void *test_worker(void *argument) {
+    struct worker *worker = argument;
+
+    for (size_t i = 0; i < worker->ops; i++) {
+        const char *value = i % 2 ? worker->values[i] : worker->misses[i];
+        uint64_t begin = now_ns();
+        encstrset_test(worker->shared_set, value, worker->key);
+        worker->latencies[i] = now_ns() - begin;
+    }
+
+    return NULL;
+}
+
+/* Inserts into a private set. */
+static void *insert_worker(void *argument) {
+    struct worker *worker = argument;
+    unsigned long set = encstrset_new();
+
+    for (size_t i = 0; i < worker->ops; i++) {
+        uint64_t begin = now_ns();
+        encstrset_insert(set, worker->values[i], worker->key);
+        worker->latencies[i] = now_ns() - begin;
+    }
+    encstrset_delete(set);
+
+    return NULL;
+}
+
+static void run_workers(const struct config *config, const char *operation,
+                        void *(*work)(void *), struct worker *workers) {
+    size_t ops = workers[0].ops;
+    uint64_t *latencies = malloc(config->threads * ops * sizeof(uint64_t));
+    pthread_t *threads = malloc(config->threads * sizeof(pthread_t));
+    uint64_t start = now_ns();
+
+    for (size_t t = 0; t < config->threads; t++)
+        pthread_create(&threads[t], NULL, work, &workers[t]);
+    for (size_t t = 0; t < config->threads; t++)
+        pthread_join(threads[t], NULL);
+
+    uint64_t elapsed = now_ns() - start;
+    for (size_t t = 0; t < config->threads; t++)
+        memcpy(latencies + t * ops, workers[t].latencies,
+               ops * sizeof(uint64_t));
+    report(config, operation, latencies, config->threads * ops, elapsed);
+
+    free(threads);
+    free(latencies);
+}
+
+/* Throughput of config->threads threads sharing one set or using their own. */
+static void bench_threads(const struct config *config) {
+    size_t ops = config->set_size;
+    char **values = make_values('v', ops, config->value_length);
+    char **misses = make_values('m', ops, config->value_length);
+    char *key = make_key(config->key_length);
+    struct worker *workers = malloc(config->threads * sizeof(struct worker));
+    unsigned long shared_set = encstrset_new();
+
+    for (size_t i = 0; i < ops; i++)
+        encstrset_insert(shared_set, values[i], key);
+
+    for (size_t t = 0; t < config->threads; t++) {
+        workers[t] = (struct worker){shared_set, values, misses, key, ops,
+                                     malloc(ops * sizeof(uint64_t))};
+    }
+
+    run_workers(config, "test_shared", test_worker, workers);
+    run_workers(config, "insert_private", insert_worker, workers);
+
+    for (size_t t = 0; t < config->threads; t++)
+        free(workers[t].latencies);
+    free(workers);
+    encstrset_delete(shared_set);
+    free(key);
+    free_values(misses);
+    free_values(values);
+}
+
+int main(int argc, char **argv) {
+    static const size_t set_sizes[] = {1000, 10000, 100000, 1000000};
+    static const size_t value_lengths[] = {8, 64, 256, 1024, 4096};
+    static const size_t key_lengths[] = {0, 1, 8, 64, 256};
+    static const unsigned hit_percents[] = {0, 50, 100};
+    static const size_t thread_counts[] = {1, 2, 4, 8, 16, 32};
+    size_t limit = 1000000;
+    struct config config;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+            limit = 10000;
+        }
+        else {
+            fprintf(stderr, "usage: %s [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* Each sweep varies one parameter around the same base case. */
+    struct config base = {"", quick ? 1000 : 100000, 16, 8, 50, 1};
+
+    for (size_t i = 0; i < sizeof(set_sizes) / sizeof(*set_sizes); i++) {
+        if (set_sizes[i] > limit)
+            continue;
+        config = base;
+        config.benchmark = "set_size";
+        config.set_size = set_sizes[i];
+        bench_operations(&config);
+    }
+
+    for (size_t i = 0; i < sizeof(value_lengths) / sizeof(*value_lengths);
+         i++) {
+        config = base;
+        config.benchmark = "value_length";
+        config.set_size = quick ? 1000 : 10000;
+        config.value_length = value_lengths[i];
+        bench_operations(&config);
+    }
+
+    for (size_t i = 0; i < sizeof(key_lengths) / sizeof(*key_lengths); i++) {
+        config = base;
+        config.benchmark = "key_length";
+        config.set_size = quick ? 1000 : 10000;
+        config.key_length = key_lengths[i];
+        bench_operations(&config);
+    }
+
+    for (size_t i = 0; i < sizeof(hit_percents) / sizeof(*hit_percents);
+         i++) {
+        config = base;
+        config.benchmark = "hit_ratio";
+        config.hit_percent = hit_percents[i];
+        bench_operations(&config);
+    }
+
+    for (size_t i = 0; i < sizeof(set_sizes) / sizeof(*set_sizes); i++) {
+        if (set_sizes[i] > limit)
+            continue;
+        config = base;
+        config.benchmark = "compact";
+        config.set_size = set_sizes[i];
+        bench_compact(&config);
+    }
+
+    for (size_t i = 0; i < sizeof(set_sizes) / sizeof(*set_sizes); i++) {
+        if (set_sizes[i] > limit)
+            continue;
+        config = base;
+        config.benchmark = "churn";
+        config.set_size = set_sizes[i];
+        bench_churn(&config);
+    }
+
+    config = base;
+    config.benchmark = "live_sets";
+    config.set_size = limit;
+    bench_live_sets(&config);
+
+    /* Without ENCSTRSET_CONCURRENT the library must not be shared. */
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(*thread_counts);
+         i++) {
+#ifndef ENCSTRSET_CONCURRENT
+        if (thread_counts[i] > 1)
+            break;
+#endif
+        if (quick && thread_counts[i] > 4)
+            break;
+        config = base;
+        config.benchmark = "threads";
+        config.set_size = quick ? 1000 : 100000;
+        config.threads = thread_counts[i];
+        bench_threads(&config);
+    }
+
+    return 0;
+}
@@ -0,0 +1,722 @@
+#include "encstrset.h"
+
+#ifdef NDEBUG
+    #undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void test_batch(void) {
+    const char *values[] = {"foo", "bar", NULL, "foo", "baz"};
+    const char *keys[] = {"123", "3x", "1", "123", NULL};
+    bool results[5];
+    unsigned long set = encstrset_new();
+
+    assert(encstrset_insert_batch(set, values, 5, "123", results) == 3);
+    assert(results[0] && results[1] && !results[2] && !results[3]);
+    assert(encstrset_test(set, "baz", "123"));
+    assert(encstrset_test_batch(set, values, 5, "123", results) == 4);
+    assert(encstrset_remove_batch(set, values, 2, "123", NULL) == 2);
+    assert(encstrset_size(set) == 1);
+
+    assert(encstrset_insert_batch_keys(set, values, keys, 5, results) == 3);
+    assert(encstrset_test(set, "bar", "3x"));
+    assert(encstrset_test(set, "baz", NULL));
+    assert(encstrset_test_batch_keys(set, values, keys, 5, results) == 4);
+    assert(encstrset_remove_batch_keys(set, values, keys, 5, results) == 3);
+    assert(!results[3]);
+    assert(encstrset_size(set) == 1);
+
+    encstrset_delete(set);
+    assert(encstrset_insert_batch(set, values, 5, NULL, results) == 0);
+    assert(!results[0]);
+}
+
+static void test_copy_on_write(void) {
+    unsigned long src = encstrset_new();
+    unsigned long dst = encstrset_new();
+
+    encstrset_insert(src, "foo", "k");
+    encstrset_insert(src, "bar", "k");
+    encstrset_copy(src, dst);
+    assert(encstrset_size(dst) == 2);
+
+    assert(encstrset_insert(dst, "baz", "k"));
+    assert(!encstrset_test(src, "baz", "k"));
+    assert(encstrset_remove(src, "foo", "k"));
+    assert(encstrset_test(dst, "foo", "k"));
+    assert(encstrset_size(src) == 1);
+    assert(encstrset_size(dst) == 3);
+
+    encstrset_copy(dst, src);
+    assert(encstrset_size(src) == 3);
+    encstrset_delete(dst);
+    assert(encstrset_test(src, "foo", "k"));
+
+    encstrset_delete(src);
+}
+
+static void insert_range(unsigned long set, size_t first, size_t last) {
+    size_t count = last - first;
+    char *buffer = malloc(count * 16);
+    const char **values = malloc(count * sizeof(const char *));
+
+    for (size_t i = 0; i < count; i++) {
+        sprintf(buffer + i * 16, "value%zu", first + i);
+        values[i] = buffer + i * 16;
+    }
+    assert(encstrset_insert_batch(set, values, count, "key", NULL) == count);
+
+    free(values);
+    free(buffer);
+}
+
+static void test_set_algebra(void) {
+    unsigned long a = encstrset_new();
+    unsigned long b = encstrset_new();
+    unsigned long dst = encstrset_new();
+
+    encstrset_insert(a, "foo", "k");
+    encstrset_insert(a, "bar", "k");
+    encstrset_insert(b, "bar", "k");
+    encstrset_insert(b, "baz", "k");
+
+    encstrset_union(dst, a, b);
+    assert(encstrset_size(dst) == 3);
+    encstrset_intersect(dst, a, b);
+    assert(encstrset_size(dst) == 1);
+    assert(encstrset_test(dst, "bar", "k"));
+    encstrset_difference(dst, a, b);
+    assert(encstrset_size(dst) == 1);
+    assert(encstrset_test(dst, "foo", "k"));
+    encstrset_difference(a, a, b);
+    assert(encstrset_size(a) == 1);
+    encstrset_union(b, a, b);
+    assert(encstrset_size(b) == 3);
+
+    /* Large enough to be split across threads. */
+    encstrset_clear(a);
+    encstrset_clear(b);
+    insert_range(a, 0, 200000);
+    insert_range(b, 100000, 300000);
+    encstrset_union(dst, a, b);
+    assert(encstrset_size(dst) == 300000);
+    encstrset_intersect(dst, a, b);
+    assert(encstrset_size(dst) == 100000);
+    assert(encstrset_test(dst, "value150000", "key"));
+    encstrset_difference(dst, b, a);
+    assert(encstrset_size(dst) == 100000);
+    assert(encstrset_test(dst, "value250000", "key"));
+    assert(!encstrset_test(dst, "value150000", "key"));
+
+    encstrset_delete(b);
+    encstrset_union(dst, a, b);
+    assert(encstrset_size(dst) == 100000);
+
+    encstrset_delete(a);
+    encstrset_delete(dst);
+}
+
+/* The snapshot layout: a header of six 64-bit fields, then slots of three
+ * (hash, offset, length), then the cypher bytes. */
+#define SNAPSHOT_HEADER_SIZE 48
+#define SNAPSHOT_SLOT_SIZE 24
+#define SNAPSHOT_ARENA_SIZE_FIELD 40
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    char *contents;
+
+    assert(file);
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    contents = malloc(*size);
+    assert(fread(contents, 1, *size, file) == *size);
+    fclose(file);
+    return contents;
+}
+
+static void write_file(const char *path, const char *contents, size_t size) {
+    FILE *file = fopen(path, "wb");
+
+    assert(file);
+    assert(fwrite(contents, 1, size, file) == size);
+    fclose(file);
+}
+
+/* Returns the slot at index i of the snapshot in contents. */
+static unsigned long long *snapshot_slot(char *contents, size_t i) {
+    return (unsigned long long *)(contents + SNAPSHOT_HEADER_SIZE +
+                                  i * SNAPSHOT_SLOT_SIZE);
+}
+
+/* Loads of truncated and corrupted snapshots fail instead of reading past
+ * the file or probing forever. */
+static void test_corrupted_snapshot(void) {
+    const char *path = "encstrset_test3.snapshot";
+    unsigned long set = encstrset_new();
+    unsigned long long arena_size;
+    size_t size, taken = 0, empty = 0;
+    char *contents, *corrupted;
+
+    insert_range(set, 0, 100);
+    assert(encstrset_save(set, path));
+    contents = read_file(path, &size);
+    memcpy(&arena_size, contents + SNAPSHOT_ARENA_SIZE_FIELD,
+           sizeof(arena_size));
+    corrupted = malloc(size);
+
+    while (snapshot_slot(contents, taken)[0] == 0)
+        taken++;
+    while (snapshot_slot(contents, empty)[0] != 0)
+        empty++;
+
+    write_file(path, contents, size - 1);
+    assert(encstrset_load(path) == ENCSTRSET_INVALID_ID);
+
+    /* A cypher running past the arena. */
+    memcpy(corrupted, contents, size);
+    snapshot_slot(corrupted, taken)[2] = arena_size;
+    write_file(path, corrupted, size);
+    assert(encstrset_load(path) == ENCSTRSET_INVALID_ID);
+
+    memcpy(corrupted, contents, size);
+    snapshot_slot(corrupted, taken)[1] = arena_size + 1;
+    snapshot_slot(corrupted, taken)[2] = 0;
+    write_file(path, corrupted, size);
+    assert(encstrset_load(path) == ENCSTRSET_INVALID_ID);
+
+    /* One more slot taken than the header counts. */
+    memcpy(corrupted, contents, size);
+    snapshot_slot(corrupted, empty)[0] = 1;
+    write_file(path, corrupted, size);
+    assert(encstrset_load(path) == ENCSTRSET_INVALID_ID);
+
+    write_file(path, contents, size);
+    encstrset_delete(set);
+    set = encstrset_load(path);
+    assert(encstrset_size(set) == 100);
+
+    remove(path);
+    free(corrupted);
+    free(contents);
+    encstrset_delete(set);
+}
+
+static void test_snapshot(void) {
+    const char *path = "encstrset_test3.snapshot";
+    unsigned long set = encstrset_new();
+    unsigned long loaded;
+
+    insert_range(set, 0, 1000);
+    assert(encstrset_save(set, path));
+    assert(!encstrset_save(set, "/nonexistent/directory/snapshot"));
+
+    loaded = encstrset_load(path);
+    assert(loaded != ENCSTRSET_INVALID_ID);
+    assert(encstrset_size(loaded) == 1000);
+    assert(encstrset_test(loaded, "value999", "key"));
+    assert(!encstrset_test(loaded, "value1000", "key"));
+
+    assert(encstrset_insert(loaded, "value1000", "key"));
+    assert(encstrset_remove(loaded, "value0", "key"));
+    assert(encstrset_size(loaded) == 1000);
+    assert(!encstrset_test(set, "value1000", "key"));
+
+    encstrset_clear(set);
+    assert(encstrset_save(set, path));
+    encstrset_delete(loaded);
+    loaded = encstrset_load(path);
+    assert(encstrset_size(loaded) == 0);
+
+    remove(path);
+    assert(encstrset_load(path) == ENCSTRSET_INVALID_ID);
+    assert(encstrset_size(ENCSTRSET_INVALID_ID) == 0);
+
+    encstrset_delete(loaded);
+    encstrset_delete(set);
+}
+
+static void test_bloom(void) {
+    unsigned long set = encstrset_new();
+    unsigned long copy = encstrset_new();
+    double observed, expected;
+    char value[32];
+
+    assert(!encstrset_bloom_stats(set, &observed, &expected));
+    insert_range(set, 0, 10000);
+    assert(encstrset_use_bloom(set, true));
+    assert(encstrset_use_bloom(copy, true));
+
+    for (int i = 0; i < 20000; i++) {
+        sprintf(value, "value%d", i);
+        assert(encstrset_test(set, value, "key") == (i < 10000));
+    }
+    assert(encstrset_bloom_stats(set, &observed, &expected));
+    assert(observed < 0.05 && expected < 0.05);
+
+    for (int i = 0; i < 10000; i += 2) {
+        sprintf(value, "value%d", i);
+        assert(encstrset_remove(set, value, "key"));
+    }
+    for (int i = 0; i < 10000; i++) {
+        sprintf(value, "value%d", i);
+        assert(encstrset_test(set, value, "key") == (i % 2 == 1));
+    }
+    assert(encstrset_insert(set, "value0", "key"));
+    assert(encstrset_test(set, "value0", "key"));
+
+    encstrset_copy(set, copy);
+    assert(encstrset_size(copy) == 5001);
+    assert(encstrset_test(copy, "value1", "key"));
+    assert(!encstrset_test(copy, "value2", "key"));
+
+    encstrset_clear(set);
+    assert(!encstrset_test(set, "value1", "key"));
+    assert(encstrset_use_bloom(set, false));
+    assert(!encstrset_bloom_stats(set, NULL, NULL));
+
+    encstrset_delete(copy);
+    encstrset_delete(set);
+}
+
+static void test_length_delimited(void) {
+    const char value[] = {'a', '\0', 'b'};
+    const char key[] = {'\0', 'k'};
+    unsigned long set = encstrset_new();
+
+    assert(encstrset_insert_n(set, value, 3, key, 2));
+    assert(!encstrset_insert_n(set, value, 3, key, 2));
+    assert(encstrset_test_n(set, value, 3, key, 2));
+    assert(!encstrset_test_n(set, value, 1, key, 2));
+    assert(!encstrset_test_n(set, value, 3, key, 1));
+    assert(encstrset_insert_n(set, "foobar", 3, "123", 3));
+    assert(encstrset_test(set, "foo", "123"));
+    assert(encstrset_insert_n(set, "", 0, NULL, 0));
+    assert(encstrset_test(set, "", NULL));
+    assert(!encstrset_insert_n(set, NULL, 0, NULL, 0));
+    assert(encstrset_remove_n(set, value, 3, key, 2));
+    assert(encstrset_size(set) == 2);
+
+    encstrset_delete(set);
+}
+
+static void test_prepared_key(void) {
+    /* Long enough values to run past the expanded key stream. */
+    const char *long_value =
+        "a value longer than the expanded stream of a short key, so that "
+        "the stream wraps around more than once";
+    struct encstrset_key *key = encstrset_key_prepare("key");
+    struct encstrset_key *odd_key = encstrset_key_prepare_n("\0x", 2);
+    unsigned long set = encstrset_new();
+
+    assert(encstrset_insert_with_key(set, long_value, key));
+    assert(encstrset_test(set, long_value, "key"));
+    assert(encstrset_insert(set, "foo", "key"));
+    assert(encstrset_test_with_key(set, "foo", key));
+    assert(!encstrset_test_with_key(set, "foo", NULL));
+    assert(encstrset_insert_with_key(set, "foo", NULL));
+    assert(encstrset_test(set, "foo", NULL));
+    assert(encstrset_insert_with_key(set, long_value, odd_key));
+    assert(encstrset_test_n(set, long_value, strlen(long_value), "\0x", 2));
+    assert(encstrset_remove_with_key(set, long_value, key));
+    assert(!encstrset_test(set, long_value, "key"));
+    assert(encstrset_size(set) == 3);
+
+    encstrset_key_release(key);
+    encstrset_key_release(odd_key);
+    encstrset_delete(set);
+}
+
+static void test_sets(void) {
+    unsigned long ids[20];
+    unsigned char bitmap[3];
+    size_t i;
+
+    for (i = 0; i < 20; i++) {
+        ids[i] = encstrset_new();
+        if (i % 3 == 0)
+            encstrset_insert(ids[i], "foo", "key");
+    }
+    encstrset_delete(ids[9]);
+    ids[10] = ENCSTRSET_INVALID_ID;
+
+    assert(encstrset_test_sets(ids, 20, "foo", "key", bitmap) == 6);
+    for (i = 0; i < 20; i++)
+        assert(((bitmap[i / 8] >> (i % 8)) & 1) ==
+               (i % 3 == 0 && i != 9));
+    assert(encstrset_test_sets(ids, 20, "foo", NULL, bitmap) == 0);
+    assert(bitmap[0] == 0 && bitmap[1] == 0 && bitmap[2] == 0);
+    assert(encstrset_test_sets(ids, 20, NULL, "key", bitmap) == 0);
+    assert(encstrset_test_sets(ids, 20, "foo", "key", NULL) == 6);
+
+    for (i = 0; i < 20; i++)
+        encstrset_delete(ids[i]);
+}
+
+static void test_growth(void) {
+    unsigned long set = encstrset_new();
+    unsigned long copy = encstrset_new();
+    char value[32];
+    size_t i;
+
+    /* Interleaved inserts and removals run through several growths. */
+    for (i = 0; i < 5000; i++) {
+        sprintf(value, "value%zu", i);
+        assert(encstrset_insert(set, value, "key"));
+        if (i % 3 == 0) {
+            sprintf(value, "value%zu", i / 2);
+            encstrset_remove(set, value, "key");
+        }
+        if (i == 2100)
+            encstrset_copy(set, copy);
+    }
+    for (i = 0; i < 5000; i++) {
+        int removed = 0;
+        size_t j;
+
+        for (j = i * 2; j <= i * 2 + 1 && j < 5000; j++)
+            removed |= j % 3 == 0;
+        sprintf(value, "value%zu", i);
+        assert(encstrset_test(set, value, "key") == !removed);
+    }
+    assert(encstrset_test(copy, "value2100", "key"));
+    assert(!encstrset_test(copy, "value2101", "key"));
+
+    assert(encstrset_reserve(set, 100000));
+    assert(encstrset_test(set, "value4999", "key"));
+    assert(!encstrset_reserve(ENCSTRSET_INVALID_ID, 10));
+
+    /* Removals compact the arena over the operations that follow them. */
+    encstrset_clear(copy);
+    assert(encstrset_use_bloom(set, true));
+    for (i = 0; i < 5000; i++) {
+        sprintf(value, "value%zu", i);
+        encstrset_remove(set, value, "key");
+        if (i % 2 == 0)
+            assert(encstrset_insert(set, value, "key"));
+        if (i == 4000)
+            encstrset_copy(set, copy);
+    }
+    for (i = 0; i < 5000; i++) {
+        sprintf(value, "value%zu", i);
+        assert(encstrset_test(set, value, "key") == (i % 2 == 0));
+        assert(encstrset_test(copy, value, "key") == (i % 2 == 0 || i > 4000));
+    }
+
+    encstrset_delete(set);
+    encstrset_delete(copy);
+}
+
+static void test_cursor(void) {
+    unsigned long set = encstrset_new();
+    struct encstrset_cursor *cursor;
+    const char *cypher;
+    size_t length, total = 0, count = 0, needed;
+    char *buffer;
+
+    encstrset_insert(set, "foo", NULL);
+    encstrset_insert(set, "barbaz", NULL);
+    cursor = encstrset_cursor_open(set);
+    assert(cursor);
+
+    /* The cursor keeps seeing the contents from when it was opened. */
+    encstrset_insert(set, "qux", NULL);
+    encstrset_remove(set, "foo", NULL);
+    while (encstrset_cursor_next(cursor, &cypher, &length)) {
+        assert((length == 3 && memcmp(cypher, "foo", 3) == 0) ||
+               (length == 6 && memcmp(cypher, "barbaz", 6) == 0));
+        total += length;
+        count++;
+    }
+    assert(count == 2 && total == 9);
+    assert(!encstrset_cursor_next(cursor, &cypher, &length));
+    encstrset_cursor_close(cursor);
+
+    needed = encstrset_export(set, NULL, 0);
+    assert(needed == 2 * sizeof(size_t) + 9);
+    buffer = malloc(needed);
+    assert(encstrset_export(set, buffer, needed) == needed);
+    memcpy(&length, buffer, sizeof(length));
+    assert(length == 3 || length == 6);
+    free(buffer);
+
+    assert(!encstrset_cursor_open(ENCSTRSET_INVALID_ID));
+    encstrset_clear(set);
+    cursor = encstrset_cursor_open(set);
+    assert(cursor && !encstrset_cursor_next(cursor, &cypher, &length));
+    encstrset_cursor_close(cursor);
+
+    encstrset_delete(set);
+}
+
+/* Allocator with a cap, which counts the bytes it has handed out. */
+struct budget {
+    size_t used;
+    size_t limit;
+};
+
+static void *budget_allocate(size_t size, void *context) {
+    struct budget *budget = context;
+
+    if (budget->used + size > budget->limit)
+        return NULL;
+    budget->used += size;
+
+    return malloc(size);
+}
+
+static void budget_release(void *memory, size_t size, void *context) {
+    struct budget *budget = context;
+
+    budget->used -= size;
+    free(memory);
+}
+
+static void test_allocator(void) {
+    struct budget budget = {0, 1 << 16};
+    struct encstrset_allocator allocator = {budget_allocate, budget_release,
+                                            &budget};
+    struct encstrset_memory usage;
+    unsigned long set = encstrset_new();
+    unsigned long copy = encstrset_new();
+    unsigned long capped = encstrset_new();
+    struct encstrset_cursor *cursor;
+    size_t inserted = 0, used, i;
+    const char *cypher;
+    size_t length;
+    char value[32];
+
+    assert(encstrset_memory_usage(set, &usage) == usage.nodes);
+    assert(usage.table == 0 && usage.payload == 0);
+
+    insert_range(set, 0, 100);
+    assert(encstrset_use_allocator(set, &allocator));
+    assert(budget.used > 0);
+    assert(encstrset_memory_usage(set, &usage) > budget.used);
+    assert(usage.table + usage.payload == budget.used);
+
+    /* Sets with different allocators do not share their contents. */
+    encstrset_copy(set, copy);
+    assert(encstrset_size(copy) == 100);
+    assert(encstrset_memory_usage(copy, &usage) > 0);
+    assert(usage.table + usage.payload > 0);
+
+    for (i = 100; i < 100000; i++) {
+        sprintf(value, "value%zu", i);
+        inserted += encstrset_insert(set, value, "key");
+    }
+    assert(inserted > 0 && inserted < 100000 - 100);
+    assert(encstrset_size(set) == 100 + inserted);
+    assert(budget.used <= budget.limit);
+    assert(encstrset_test(set, "value0", "key"));
+
+    assert(encstrset_use_allocator(set, NULL));
+    assert(budget.used == 0);
+    assert(encstrset_size(set) == 100 + inserted);
+    assert(!encstrset_use_allocator(ENCSTRSET_INVALID_ID, &allocator));
+    assert(encstrset_memory_usage(ENCSTRSET_INVALID_ID, &usage) == 0);
+
+    /* Copies and set algebra into a set out of memory leave it as it was. */
+    budget.limit = 1 << 10;
+    assert(encstrset_use_allocator(capped, &allocator));
+    encstrset_copy(set, capped);
+    assert(encstrset_size(capped) == 0);
+    assert(budget.used == 0);
+
+    assert(encstrset_insert(capped, "foo", "key"));
+    used = budget.used;
+    encstrset_copy(set, capped);
+    assert(encstrset_size(capped) == 1);
+    assert(encstrset_test(capped, "foo", "key"));
+    assert(!encstrset_test(capped, "value0", "key"));
+    assert(budget.used == used);
+
+    encstrset_union(capped, set, copy);
+    assert(encstrset_size(capped) == 1);
+    assert(encstrset_test(capped, "foo", "key"));
+    assert(budget.used == used);
+
+    /* A cursor over a compacted set needs memory to expand it. */
+    assert(encstrset_compact(capped));
+    assert(budget.used == 0);
+    budget.limit = 0;
+    assert(encstrset_cursor_open(capped) == NULL);
+    budget.limit = 1 << 10;
+    cursor = encstrset_cursor_open(capped);
+    assert(cursor != NULL);
+    assert(encstrset_cursor_next(cursor, &cypher, &length));
+    assert(!encstrset_cursor_next(cursor, &cypher, &length));
+    encstrset_cursor_close(cursor);
+    assert(budget.used == 0);
+
+    encstrset_delete(set);
+    encstrset_delete(copy);
+    encstrset_delete(capped);
+}
+
+static void test_move_swap(void) {
+    unsigned long a = encstrset_new();
+    unsigned long b = encstrset_new();
+
+    insert_range(a, 0, 10);
+    insert_range(b, 10, 13);
+    encstrset_use_bloom(b, true);
+
+    encstrset_swap(a, b);
+    assert(encstrset_size(a) == 3 && encstrset_size(b) == 10);
+    assert(encstrset_test(a, "value10", "key"));
+    assert(!encstrset_test(a, "value0", "key"));
+    assert(encstrset_test(b, "value0", "key"));
+    assert(!encstrset_test(b, "value10", "key"));
+
+    encstrset_move(b, a);
+    assert(encstrset_size(a) == 10 && encstrset_size(b) == 0);
+    assert(encstrset_test(a, "value0", "key"));
+    assert(!encstrset_test(a, "value10", "key"));
+    assert(encstrset_insert(b, "value0", "key"));
+
+    encstrset_move(a, a);
+    assert(encstrset_size(a) == 10);
+    encstrset_move(a, ENCSTRSET_INVALID_ID);
+    assert(encstrset_size(a) == 10);
+
+    encstrset_delete(a);
+    encstrset_delete(b);
+}
+
+static bool count_visit(const char *cypher, size_t length, void *context) {
+    (void)cypher;
+    (void)length;
+    ++*(size_t *)context;
+
+    return true;
+}
+
+static bool stop_visit(const char *cypher, size_t length, void *context) {
+    (void)cypher;
+    (void)length;
+    (void)context;
+
+    return false;
+}
+
+static void test_ordered(void) {
+    unsigned long set = encstrset_new_ordered();
+    unsigned long other = encstrset_new_ordered();
+    unsigned long plain = encstrset_new();
+    size_t visited = 0;
+
+    insert_range(set, 0, 5000);
+    assert(encstrset_scan_prefix(set, "value12", "key", count_visit,
+                                 &visited) == 111);
+    assert(visited == 111);
+    assert(encstrset_scan_prefix(set, "value", "key", stop_visit, NULL) == 1);
+    assert(encstrset_scan_prefix(set, "value12", NULL, count_visit,
+                                 &visited) == 0);
+
+    assert(encstrset_remove(set, "value123", "key"));
+    assert(encstrset_scan_prefix(set, "value123", "key", count_visit,
+                                 &visited) == 10);
+
+    /* Ordered copies share the tree until one of them changes. */
+    encstrset_copy(set, other);
+    assert(encstrset_remove(other, "value1234", "key"));
+    assert(encstrset_insert(set, "value123", "key"));
+    assert(encstrset_scan_prefix(set, "value123", "key", count_visit,
+                                 &visited) == 11);
+    assert(encstrset_scan_prefix(other, "value123", "key", count_visit,
+                                 &visited) == 9);
+    assert(encstrset_remove(set, "value123", "key"));
+
+    encstrset_copy(set, plain);
+    assert(encstrset_scan_prefix(plain, "value123", "key", count_visit,
+                                 &visited) == 10);
+    encstrset_clear(set);
+    assert(encstrset_scan_prefix(set, "", NULL, count_visit, &visited) == 0);
+    encstrset_move(plain, set);
+    assert(encstrset_scan_prefix(set, "value4", "key", count_visit,
+                                 &visited) == 1111);
+    assert(encstrset_scan_prefix(ENCSTRSET_INVALID_ID, "", NULL, count_visit,
+                                 &visited) == 0);
+
+    encstrset_delete(set);
+    encstrset_delete(other);
+    encstrset_delete(plain);
+}
+
+static void test_compact(void) {
+    unsigned long set = encstrset_new();
+    unsigned long other = encstrset_new();
+    struct encstrset_cursor *cursor;
+    struct encstrset_memory before, after;
+    size_t visited = 0, count = 0;
+    char value[16];
+
+    insert_range(set, 0, 20000);
+    encstrset_memory_usage(set, &before);
+    assert(encstrset_compact(set));
+    assert(encstrset_compact(set));
+    encstrset_memory_usage(set, &after);
+    assert(after.table + after.payload < (before.table + before.payload) / 2);
+
+    assert(encstrset_size(set) == 20000);
+    for (size_t i = 0; i < 20000; i += 7) {
+        sprintf(value, "value%zu", i);
+        assert(encstrset_test(set, value, "key"));
+        sprintf(value, "value%zu", i + 20000);
+        assert(!encstrset_test(set, value, "key"));
+        assert(!encstrset_test(set, "value1", "kez"));
+    }
+    assert(!encstrset_test(set, "value", "key"));
+    assert(!encstrset_test(set, "value12345x", "key"));
+    assert(encstrset_scan_prefix(set, "value123", "key", count_visit,
+                                 &visited) == 111);
+    assert(encstrset_scan_prefix(set, "", NULL, stop_visit, NULL) == 1);
+
+    /* Copies share the compact form, modifications expand it. */
+    encstrset_copy(set, other);
+    cursor = encstrset_cursor_open(other);
+    while (encstrset_cursor_next(cursor, NULL, NULL))
+        count++;
+    encstrset_cursor_close(cursor);
+    assert(count == 20000);
+    assert(encstrset_remove(other, "value5", "key"));
+    assert(!encstrset_insert(other, "value6", "key"));
+    assert(encstrset_test(set, "value5", "key"));
+    assert(!encstrset_test(other, "value5", "key"));
+
+    encstrset_difference(other, set, other);
+    assert(encstrset_size(other) == 1);
+    assert(encstrset_test(other, "value5", "key"));
+    assert(encstrset_insert(set, "value20000", "key"));
+    assert(encstrset_size(set) == 20001);
+
+    encstrset_delete(set);
+    encstrset_delete(other);
+    assert(!encstrset_compact(set));
+}
+
+int main(void) {
+    test_batch();
+    test_copy_on_write();
+    test_set_algebra();
+    test_snapshot();
+    test_corrupted_snapshot();
+    test_bloom();
+    test_length_delimited();
+    test_prepared_key();
+    test_sets();
+    test_growth();
+    test_cursor();
+    test_allocator();
+    test_move_swap();
+    test_ordered();
+    test_compact();
+
+    return 0;
+}
@@ -1,5 +1,13 @@
 #include "geometry.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+#include <utility>
+
 bool Position::operator==(const Position &secondPosition) const
 {
     return _x == secondPosition._x && _y == secondPosition._y;
@@ -60,30 +68,537 @@ Rectangle Rectangle::reflection() const
     return Rectangle(_height, _width, _pos.reflection());
 }
 
-Rectangle &Rectangles::operator[](size_t i)
+namespace
+{
+    // Stored coordinates may lie anywhere modulo 2^32, so they are shifted
+    // without signed overflow.
+    int32_t wrapping_add(int32_t a, int32_t b)
+    {
+        return int32_t(uint32_t(a) + uint32_t(b));
+    }
+
+    int32_t wrapping_sub(int32_t a, int32_t b)
+    {
+        return int32_t(uint32_t(a) - uint32_t(b));
+    }
+} // namespace
+
+Position RectangleReference::pos() const
+{
+    return Position(wrapping_add(_rectangles._x[_i], _rectangles._offset.x()),
+                    wrapping_add(_rectangles._y[_i], _rectangles._offset.y()));
+}
+
+RectangleReference &RectangleReference::operator=(const Rectangle &rectangle)
+{
+    _rectangles._x[_i] = wrapping_sub(rectangle.pos().x(), _rectangles._offset.x());
+    _rectangles._y[_i] = wrapping_sub(rectangle.pos().y(), _rectangles._offset.y());
+    _rectangles._width[_i] = rectangle.width();
+    _rectangles._height[_i] = rectangle.height();
+    return *this;
+}
+
+RectangleReference &RectangleReference::operator=(const RectangleReference &secondReference)
+{
+    return *this = Rectangle(secondReference);
+}
+
+bool RectangleReference::operator==(const Rectangle &rectangle) const
+{
+    return Rectangle(*this) == rectangle;
+}
+
+RectangleReference &RectangleReference::operator+=(const Vector &vector)
+{
+    _rectangles._x[_i] = wrapping_add(_rectangles._x[_i], vector.x());
+    _rectangles._y[_i] = wrapping_add(_rectangles._y[_i], vector.y());
+    return *this;
+}
+
+Rectangle RectangleReference::reflection() const
+{
+    return Rectangle(*this).reflection();
+}
+
+Rectangles::Rectangles(std::initializer_list<Rectangle> rectangles)
+{
+    _x.reserve(rectangles.size());
+    _y.reserve(rectangles.size());
+    _width.reserve(rectangles.size());
+    _height.reserve(rectangles.size());
+    for (const Rectangle &rectangle : rectangles)
+        push_back(rectangle);
+}
+
+RectangleReference Rectangles::operator[](size_t i)
 {
-    return _rectangles[i];
+    assert(i < size());
+    return RectangleReference(*this, i);
 }
 
-const Rectangle &Rectangles::operator[](size_t i) const
+const Rectangle Rectangles::operator[](size_t i) const
 {
-    return _rectangles[i];
+    assert(i < size());
+    return Rectangle(_width[i], _height[i],
+                     Position(wrapping_add(_x[i], _offset.x()), wrapping_add(_y[i], _offset.y())));
 }
 
+// Collections with equal offsets compare their arrays as they are; the
+// others compare the differences of their offsets.
 bool Rectangles::operator==(const Rectangles &rectangles)
 {
-    return _rectangles == rectangles._rectangles;
+    if (_width != rectangles._width || _height != rectangles._height)
+        return false;
+    if (_offset == rectangles._offset)
+        return _x == rectangles._x && _y == rectangles._y;
+
+    int32_t dx = wrapping_sub(rectangles._offset.x(), _offset.x());
+    int32_t dy = wrapping_sub(rectangles._offset.y(), _offset.y());
+    size_t size = _x.size();
+    for (size_t i = 0; i < size; i++)
+    {
+        if (_x[i] != wrapping_add(rectangles._x[i], dx) ||
+            _y[i] != wrapping_add(rectangles._y[i], dy))
+            return false;
+    }
+    return true;
 }
 
 Rectangles &Rectangles::operator+=(const Vector &vector)
 {
-    size_t size = _rectangles.size();
+    _offset = Vector(wrapping_add(_offset.x(), vector.x()), wrapping_add(_offset.y(), vector.y()));
+
+    return *this;
+}
+
+void Rectangles::push_back(const Rectangle &rectangle)
+{
+    _x.push_back(wrapping_sub(rectangle.pos().x(), _offset.x()));
+    _y.push_back(wrapping_sub(rectangle.pos().y(), _offset.y()));
+    _width.push_back(rectangle.width());
+    _height.push_back(rectangle.height());
+}
+
+// Reflecting every rectangle swaps x with y and width with height, which
+// in this layout means swapping whole arrays.
+Rectangles Rectangles::reflection() const
+{
+    Rectangles reflected(*this);
+    std::swap(reflected._x, reflected._y);
+    std::swap(reflected._width, reflected._height);
+    reflected._offset = _offset.reflection();
+    return reflected;
+}
+
+// Sizes are positive, so the products are taken unsigned: a widening
+// unsigned multiply vectorizes already with SSE2, a signed one does not.
+int64_t Rectangles::area_sum() const
+{
+    const int32_t *width = _width.data();
+    const int32_t *height = _height.data();
+    size_t size = _width.size();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+        sum += uint64_t(uint32_t(width[i])) * uint32_t(height[i]);
+
+    return int64_t(sum);
+}
+
+namespace
+{
+    // Cover counts over the elementary intervals between consecutive
+    // distinct ys, with how much of every node's span is covered at least
+    // once and at least twice. A count applies to the whole span of its
+    // node and is never pushed down, so a node's lengths follow from its
+    // count and its children. Nodes are laid out bottom-up in one array,
+    // the children of node i being 2i and 2i + 1 and the leaves, padded
+    // to a power of two with empty ones, following the inner nodes.
+    class CoverTree
+    {
+    private:
+        struct Node
+        {
+            int64_t span, once, twice;
+            int32_t count;
+        };
+
+        size_t _leaves;
+        std::vector<Node> _nodes;
+
+        // Returns whether the lengths of the node changed.
+        bool update(size_t i)
+        {
+            Node &node = _nodes[i];
+            int64_t once = 0, twice = 0;
+            if (i < _leaves)
+            {
+                once = _nodes[2 * i].once + _nodes[2 * i + 1].once;
+                twice = _nodes[2 * i].twice + _nodes[2 * i + 1].twice;
+            }
+            int64_t old_once = node.once, old_twice = node.twice;
+            node.once = node.count >= 1 ? node.span : once;
+            node.twice = node.count >= 2 ? node.span : node.count == 1 ? once : twice;
+            return node.once != old_once || node.twice != old_twice;
+        }
+
+    public:
+        explicit CoverTree(const std::vector<int64_t> &ys) : _leaves(1)
+        {
+            while (_leaves < ys.size() - 1)
+                _leaves *= 2;
+            _nodes.resize(2 * _leaves);
+            for (size_t i = 0; i + 1 < ys.size(); i++)
+                _nodes[_leaves + i].span = ys[i + 1] - ys[i];
+            for (size_t i = _leaves; i-- > 1;)
+                _nodes[i].span = _nodes[2 * i].span + _nodes[2 * i + 1].span;
+        }
+
+        // Adds delta to the counts of intervals [first, last). The nodes
+        // whose counts change are children of ancestors of the first and
+        // the last interval, which are updated after them. None lie above
+        // the common ancestor of the two, so past it the updates stop at
+        // the first node whose lengths stay the same.
+        void add(size_t first, size_t last, int32_t delta)
+        {
+            size_t l = first + _leaves, r = last + _leaves;
+            for (; l < r; l >>= 1, r >>= 1)
+            {
+                if (l & 1)
+                {
+                    _nodes[l].count += delta;
+                    update(l++);
+                }
+                if (r & 1)
+                {
+                    _nodes[--r].count += delta;
+                    update(r);
+                }
+            }
+
+            l = (first + _leaves) >> 1;
+            r = (last - 1 + _leaves) >> 1;
+            for (; l != r; l >>= 1, r >>= 1)
+            {
+                update(l);
+                update(r);
+            }
+            if (l > 0)
+                update(l);
+            for (l >>= 1; l > 0; l >>= 1)
+            {
+                if (!update(l))
+                    break;
+            }
+        }
+
+        int64_t covered_once() const { return _nodes[1].once; }
+
+        int64_t covered_twice() const { return _nodes[1].twice; }
+    };
+
+    // How many of the added points lie before a given one, in O(log n).
+    // Counts stay below 2^31 as long as the points do.
+    class PrefixCounts
+    {
+    private:
+        std::vector<int32_t> _tree;
+
+    public:
+        explicit PrefixCounts(size_t size) : _tree(size + 1) {}
+
+        void add(size_t i, int32_t delta)
+        {
+            for (i++; i < _tree.size(); i += i & -i)
+                _tree[i] += delta;
+        }
+
+        // Points in [0, end).
+        int32_t count(size_t end) const
+        {
+            int32_t count = 0;
+            for (; end > 0; end -= end & -end)
+                count += _tree[end];
+            return count;
+        }
+    };
+
+    // Adds length * width to area, or leaves INT64_MAX there when the sum
+    // does not fit. Areas only grow, so once a sum does not fit, the final
+    // one would not either.
+    void add_area(int64_t &area, int64_t length, int64_t width)
+    {
+        int64_t product;
+        if (__builtin_mul_overflow(length, width, &product) ||
+            __builtin_add_overflow(area, product, &area))
+            area = std::numeric_limits<int64_t>::max();
+    }
+
+    // A bottom or top side of a rectangle, the id telling the rectangle and
+    // which side it is.
+    struct Bound
+    {
+        int64_t y;
+        size_t id;
+
+        bool operator<(const Bound &bound) const { return y < bound.y; }
+    };
+
+    // The left or right side of a rectangle, with its bottom and top as
+    // indices into the distinct ys, so that the sweep reads them in order.
+    struct Side
+    {
+        int64_t x;
+        uint32_t bottom, top;
+
+        bool operator<(const Side &side) const { return x < side.x; }
+    };
+} // namespace
+
+// A line sweeps left to right over the left and right edges, ending
+// rectangles before starting new ones at the same x, since rectangles are
+// half-open. Between two edges the covered parts of the line are constant,
+// so the areas grow by their length times the distance swept. A starting
+// rectangle overlaps every active one but those entirely below or above
+// it, which are counted by their tops and bottoms.
+Rectangles::Coverage Rectangles::coverage() const
+{
+    Coverage coverage{0, 0, 0};
+    size_t size = _x.size();
+    if (size == 0)
+        return coverage;
+
+    std::vector<Bound> bounds(2 * size);
+    for (size_t i = 0; i < size; i++)
+    {
+        int64_t y = wrapping_add(_y[i], _offset.y());
+        bounds[2 * i] = {y, 2 * i};
+        bounds[2 * i + 1] = {y + _height[i], 2 * i + 1};
+    }
+    std::sort(bounds.begin(), bounds.end());
+
+    // Distinct ys, and the bottom and top of every rectangle as indices
+    // into them. There are fewer than 2^32 of them for any collection
+    // which fits in memory.
+    std::vector<int64_t> ys;
+    std::vector<Side> starts(size), ends(size);
+    for (const Bound &bound : bounds)
+    {
+        if (ys.empty() || ys.back() != bound.y)
+            ys.push_back(bound.y);
+        Side &start = starts[bound.id / 2];
+        (bound.id & 1 ? start.top : start.bottom) = uint32_t(ys.size() - 1);
+    }
+    bounds.clear();
+    bounds.shrink_to_fit();
+
     for (size_t i = 0; i < size; i++)
-        _rectangles[i] += vector;
+    {
+        starts[i].x = wrapping_add(_x[i], _offset.x());
+        ends[i] = {starts[i].x + _width[i], starts[i].bottom, starts[i].top};
+    }
+    std::sort(starts.begin(), starts.end());
+    std::sort(ends.begin(), ends.end());
+
+    CoverTree tree(ys);
+    PrefixCounts bottoms(ys.size()), tops(ys.size());
+    int32_t active = 0;
+    int64_t x = starts[0].x;
+    for (size_t s = 0, e = 0; e < size;)
+    {
+        bool start = s < size && starts[s].x < ends[e].x;
+        const Side &side = start ? starts[s++] : ends[e++];
+        add_area(coverage.union_area, tree.covered_once(), side.x - x);
+        add_area(coverage.overlap_area, tree.covered_twice(), side.x - x);
+        x = side.x;
+
+        int32_t delta = start ? 1 : -1;
+        if (start)
+        {
+            int32_t below = tops.count(side.bottom + 1);
+            int32_t above = active - bottoms.count(side.top);
+            coverage.overlapping_pairs += active - below - above;
+        }
+        tree.add(side.bottom, side.top, delta);
+        bottoms.add(side.bottom, delta);
+        tops.add(side.top, delta);
+        active += delta;
+    }
+    return coverage;
+}
+
+namespace
+{
+    constexpr size_t NODE_SIZE = 16;
+
+    // Inserted rectangles become a tree once MAX_PENDING of them wait.
+    constexpr size_t MAX_PENDING = 64;
+
+    template<typename Box>
+    bool boxes_overlap(const Box &a, const Box &b)
+    {
+        return a.min_x < b.max_x && b.min_x < a.max_x &&
+               a.min_y < b.max_y && b.min_y < a.max_y;
+    }
+
+    template<typename Box>
+    Box bounding_box(const Box &a, const Box &b)
+    {
+        return {std::min(a.min_x, b.min_x), std::min(a.min_y, b.min_y),
+                std::max(a.max_x, b.max_x), std::max(a.max_y, b.max_y)};
+    }
+
+    // Boxes of the parents of every NODE_SIZE consecutive boxes.
+    template<typename Box, typename BoxOf>
+    std::vector<Box> parent_boxes(size_t count, BoxOf box_of)
+    {
+        std::vector<Box> parents;
+        parents.reserve((count + NODE_SIZE - 1) / NODE_SIZE);
+        for (size_t first = 0; first < count; first += NODE_SIZE)
+        {
+            Box parent = box_of(first);
+            for (size_t i = first + 1; i < std::min(count, first + NODE_SIZE); i++)
+                parent = bounding_box(parent, box_of(i));
+            parents.push_back(parent);
+        }
+        return parents;
+    }
+} // namespace
 
+RectangleIndex::RectangleIndex(const Rectangles &rectangles) : _size(rectangles.size())
+{
+    std::vector<Entry> entries;
+    entries.reserve(rectangles.size());
+    for (size_t i = 0; i < rectangles.size(); i++)
+        entries.push_back({box_of(rectangles[i]), i});
+    if (!entries.empty())
+        _trees.emplace_back(std::move(entries));
+}
+
+RectangleIndex::Box RectangleIndex::box_of(const Rectangle &rectangle) const
+{
+    int64_t x = rectangle.pos().x() - _offset_x;
+    int64_t y = rectangle.pos().y() - _offset_y;
+    return {x, y, x + rectangle.width(), y + rectangle.height()};
+}
+
+RectangleIndex::Tree::Tree(std::vector<Entry> tree_entries) : entries(std::move(tree_entries))
+{
+    auto center_x = [](const Entry &entry) { return entry.box.min_x + entry.box.max_x; };
+    auto center_y = [](const Entry &entry) { return entry.box.min_y + entry.box.max_y; };
+    size_t leaves = (entries.size() + NODE_SIZE - 1) / NODE_SIZE;
+    size_t slabs = size_t(std::ceil(std::sqrt(double(leaves))));
+    size_t slab_size = (leaves + slabs - 1) / slabs * NODE_SIZE;
+
+    std::sort(entries.begin(), entries.end(), [&](const Entry &a, const Entry &b)
+    {
+        return center_x(a) < center_x(b);
+    });
+    for (size_t first = 0; first < entries.size(); first += slab_size)
+    {
+        auto last = entries.begin() + std::min(entries.size(), first + slab_size);
+        std::sort(entries.begin() + first, last, [&](const Entry &a, const Entry &b)
+        {
+            return center_y(a) < center_y(b);
+        });
+    }
+
+    levels.push_back(parent_boxes<Box>(entries.size(), [&](size_t i)
+    {
+        return entries[i].box;
+    }));
+    while (levels.back().size() > 1)
+    {
+        const std::vector<Box> &children = levels.back();
+        levels.push_back(parent_boxes<Box>(children.size(), [&](size_t i)
+        {
+            return children[i];
+        }));
+    }
+}
+
+// Walks down from the root, keeping the nodes still to visit on a stack
+// of (level, node) pairs. Children of the nodes on level 0 are entries.
+void RectangleIndex::Tree::find(const Box &query, std::vector<size_t> &found) const
+{
+    std::vector<std::pair<size_t, size_t>> stack;
+    if (boxes_overlap(levels.back()[0], query))
+        stack.emplace_back(levels.size() - 1, 0);
+
+    while (!stack.empty())
+    {
+        auto [level, node] = stack.back();
+        stack.pop_back();
+
+        size_t first = node * NODE_SIZE;
+        if (level == 0)
+        {
+            for (size_t i = first; i < std::min(entries.size(), first + NODE_SIZE); i++)
+                if (boxes_overlap(entries[i].box, query))
+                    found.push_back(entries[i].id);
+            continue;
+        }
+
+        const std::vector<Box> &children = levels[level - 1];
+        for (size_t i = first; i < std::min(children.size(), first + NODE_SIZE); i++)
+            if (boxes_overlap(children[i], query))
+                stack.emplace_back(level - 1, i);
+    }
+}
+
+// A tree is merged with the next larger one while that one is at most as
+// large, so every tree is more than twice as large as the one after it,
+// and each rectangle is sorted into a new tree O(log n) times.
+size_t RectangleIndex::insert(const Rectangle &rectangle)
+{
+    size_t id = _size++;
+    _pending.push_back({box_of(rectangle), id});
+    if (_pending.size() < MAX_PENDING)
+        return id;
+
+    std::vector<Entry> entries = std::move(_pending);
+    _pending.clear();
+    while (!_trees.empty() && _trees.back().entries.size() <= entries.size())
+    {
+        const std::vector<Entry> &smaller = _trees.back().entries;
+        entries.insert(entries.end(), smaller.begin(), smaller.end());
+        _trees.pop_back();
+    }
+    _trees.emplace_back(std::move(entries));
+    return id;
+}
+
+RectangleIndex &RectangleIndex::operator+=(const Vector &vector)
+{
+    _offset_x += vector.x();
+    _offset_y += vector.y();
     return *this;
 }
 
+std::vector<size_t> RectangleIndex::containing(const Position &position) const
+{
+    int64_t x = position.x() - _offset_x;
+    int64_t y = position.y() - _offset_y;
+    return overlapping(Box{x, y, x + 1, y + 1});
+}
+
+std::vector<size_t> RectangleIndex::overlapping(const Rectangle &rectangle) const
+{
+    return overlapping(box_of(rectangle));
+}
+
+std::vector<size_t> RectangleIndex::overlapping(const Box &query) const
+{
+    std::vector<size_t> found;
+    for (const Tree &tree : _trees)
+        tree.find(query, found);
+    for (const Entry &entry : _pending)
+        if (boxes_overlap(entry.box, query))
+            found.push_back(entry.id);
+
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
 Position operator+(const Position &position, const Vector &vector)
 {
     return Position(position) += vector;
@@ -159,16 +674,330 @@ namespace
         }
         return false;
     }
+
+    // Merges rectangles [begin, end) one by one into final.
+    Rectangle fold(const Rectangles &rectangles, size_t begin, size_t end, Rectangle final)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            bool merge_done=merge_one(final, rectangles[i]);
+            assert(merge_done);
+        }
+        return final;
+    }
+
+    // Below this many rectangles a thread, starting it costs more than it
+    // saves.
+    constexpr size_t MIN_CHUNK = 1 << 15;
+
+    struct Extent
+    {
+        int64_t min_x, min_y, max_x, max_y;
+    };
+
+    Extent join(const Extent &a, const Extent &b)
+    {
+        return {std::min(a.min_x, b.min_x), std::min(a.min_y, b.min_y),
+                std::max(a.max_x, b.max_x), std::max(a.max_y, b.max_y)};
+    }
+
+    Extent extent(const Rectangles &rectangles, size_t begin, size_t end)
+    {
+        Extent extent{INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN};
+        for (size_t i = begin; i < end; i++)
+        {
+            Rectangle r = rectangles[i];
+            extent = join(extent, {r.pos().x(), r.pos().y(),
+                                   int64_t(r.pos().x()) + r.width(),
+                                   int64_t(r.pos().y()) + r.height()});
+        }
+        return extent;
+    }
+
+    Rectangle rectangle(const Extent &extent)
+    {
+        return Rectangle(int32_t(extent.max_x - extent.min_x), int32_t(extent.max_y - extent.min_y),
+                         Position(int32_t(extent.min_x), int32_t(extent.min_y)));
+    }
+
+    // Calls chunk(c) for c in [0, chunks), each on a thread of its own but
+    // the first, which runs on the calling one.
+    template<typename Chunk>
+    void run_chunks(size_t chunks, Chunk chunk)
+    {
+        std::vector<std::thread> threads;
+        for (size_t c = 1; c < chunks; c++)
+            threads.emplace_back(chunk, c);
+        chunk(0);
+        for (std::thread &thread : threads)
+            thread.join();
+    }
 } // namespace
 
 Rectangle merge_all(Rectangles rectangles)
 {
     assert(rectangles.size());
-    Rectangle final = rectangles[0];
-    for (size_t i = 1; i < rectangles.size(); i++)
+    return fold(rectangles, 1, rectangles.size(), rectangles[0]);
+}
+
+Rectangle merge_all_parallel(const Rectangles &rectangles, unsigned threads)
+{
+    assert(rectangles.size());
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunks = std::min<size_t>(threads, rectangles.size() / MIN_CHUNK);
+    if (chunks <= 1)
+        return fold(rectangles, 1, rectangles.size(), rectangles[0]);
+
+    auto begin = [&](size_t c) { return rectangles.size() * c / chunks; };
+
+    std::vector<Extent> extents(chunks);
+    run_chunks(chunks, [&](size_t c)
     {
-        bool merge_done=merge_one(final, rectangles[i]);
-        assert(merge_done);
-    }
-    return final;
+        extents[c] = extent(rectangles, begin(c), begin(c + 1));
+    });
+
+    // Every prefix of a valid merge order is merged into its extent, so
+    // the extents of the chunks before one give exactly the rectangle the
+    // serial fold has merged when it reaches that chunk.
+    std::vector<Extent> before(chunks);
+    before[0] = extents[0];
+    for (size_t c = 1; c < chunks; c++)
+        before[c] = join(before[c - 1], extents[c]);
+
+#ifndef NDEBUG
+    // Check every merge as merge_all does, each chunk starting from what
+    // the serial fold would hold there.
+    run_chunks(chunks, [&](size_t c)
+    {
+        Rectangle final = c == 0 ? fold(rectangles, 1, begin(1), rectangles[0])
+                                 : fold(rectangles, begin(c), begin(c + 1), rectangle(before[c - 1]));
+        assert(final == rectangle(before[c]));
+    });
+#endif
+
+    return rectangle(before[chunks - 1]);
+}
+
+namespace
+{
+    // A rectangle tiled by rectangles can be merged step by step exactly
+    // when a straight cut splits it into two parts that can be merged in
+    // the same way. Merging whichever pair shares an edge is not enough:
+    // it may join tiles on the two sides of the only cut.
+    //
+    // Parts keep their rectangles linked in four orders: by left, right,
+    // bottom and top edge. A cut is searched for from both ends of both
+    // axes at once, one rectangle at a time, so finding it costs as much
+    // as the smaller side; that side is then unlinked and sorted into a
+    // part of its own. Every rectangle moves to a smaller side O(log n)
+    // times, which bounds the whole search by O(n log^2 n).
+    class CutFinder
+    {
+    private:
+        enum Order { BY_LEFT, BY_RIGHT, BY_BOTTOM, BY_TOP, ORDERS };
+
+        static constexpr size_t NONE = SIZE_MAX;
+
+        struct Bounds
+        {
+            int64_t left, bottom, right, top;
+        };
+
+        struct Part
+        {
+            std::array<size_t, ORDERS> head, tail;
+        };
+
+        // A part, or two parts to merge side by side or one above another,
+        // the first one being to the left or at the bottom.
+        struct Node
+        {
+            size_t part, first, second;
+            bool side_by_side;
+        };
+
+        std::vector<Bounds> _bounds;
+        std::array<std::vector<size_t>, ORDERS> _next, _prev;
+        std::vector<Part> _parts;
+
+        int64_t key(Order order, size_t i) const
+        {
+            const Bounds &b = _bounds[i];
+            switch (order)
+            {
+                case BY_LEFT: return b.left;
+                case BY_RIGHT: return b.right;
+                case BY_BOTTOM: return b.bottom;
+                default: return b.top;
+            }
+        }
+
+        // Scans on the left and bottom run forwards, the others backwards.
+        static bool forwards(Order order) { return order == BY_LEFT || order == BY_BOTTOM; }
+
+        size_t new_part(std::vector<size_t> &rectangles)
+        {
+            Part part;
+            for (int order = 0; order < ORDERS; order++)
+            {
+                std::sort(rectangles.begin(), rectangles.end(), [&](size_t a, size_t b)
+                {
+                    return key(Order(order), a) < key(Order(order), b);
+                });
+                size_t previous = NONE;
+                for (size_t i : rectangles)
+                {
+                    _prev[order][i] = previous;
+                    if (previous != NONE)
+                        _next[order][previous] = i;
+                    previous = i;
+                }
+                _next[order][previous] = NONE;
+                part.head[order] = rectangles.front();
+                part.tail[order] = rectangles.back();
+            }
+            _parts.push_back(part);
+            return _parts.size() - 1;
+        }
+
+        void unlink(Part &part, size_t i)
+        {
+            for (int order = 0; order < ORDERS; order++)
+            {
+                size_t next = _next[order][i], prev = _prev[order][i];
+                (prev == NONE ? part.head[order] : _next[order][prev]) = next;
+                (next == NONE ? part.tail[order] : _prev[order][next]) = prev;
+            }
+        }
+
+        // Scans from the ends of part until one scan passes a set of
+        // rectangles that the next one lies entirely beyond. Returns the
+        // order of that scan and the rectangles it passed, or nothing when
+        // no cut splits the part.
+        std::optional<std::pair<Order, std::vector<size_t>>> find_cut(const Part &part) const
+        {
+            std::array<size_t, ORDERS> at;
+            std::array<int64_t, ORDERS> reach;
+            std::array<std::vector<size_t>, ORDERS> passed;
+            for (int order = 0; order < ORDERS; order++)
+            {
+                at[order] = forwards(Order(order)) ? part.head[order] : part.tail[order];
+                reach[order] = forwards(Order(order)) ? INT64_MIN : INT64_MAX;
+            }
+
+            for (size_t scans = ORDERS; scans > 0;)
+            {
+                scans = 0;
+                for (int order = 0; order < ORDERS; order++)
+                {
+                    size_t i = at[order];
+                    if (i == NONE)
+                        continue;
+                    scans++;
+
+                    Order o = Order(order);
+                    passed[order].push_back(i);
+                    // The far edge of what has been passed: the right one
+                    // for a scan by left edges, and so on.
+                    Order far = Order(order ^ 1);
+                    reach[order] = forwards(o) ? std::max(reach[order], key(far, i))
+                                               : std::min(reach[order], key(far, i));
+
+                    size_t next = forwards(o) ? _next[order][i] : _prev[order][i];
+                    at[order] = next;
+                    if (next != NONE && (forwards(o) ? key(o, next) >= reach[order]
+                                                     : key(o, next) <= reach[order]))
+                        return std::make_pair(o, std::move(passed[order]));
+                }
+            }
+            return std::nullopt;
+        }
+
+    public:
+        explicit CutFinder(const Rectangles &rectangles)
+        {
+            for (int order = 0; order < ORDERS; order++)
+            {
+                _next[order].resize(rectangles.size());
+                _prev[order].resize(rectangles.size());
+            }
+            for (size_t i = 0; i < rectangles.size(); i++)
+            {
+                Rectangle r = rectangles[i];
+                int64_t x = r.pos().x(), y = r.pos().y();
+                _bounds.push_back({x, y, x + r.width(), y + r.height()});
+            }
+        }
+
+        std::optional<Rectangle> merge(const Rectangles &rectangles)
+        {
+            if (rectangles.size() == 0)
+                return std::nullopt;
+
+            std::vector<size_t> all(rectangles.size());
+            for (size_t i = 0; i < all.size(); i++)
+                all[i] = i;
+            std::vector<Node> nodes{{new_part(all), NONE, NONE, false}};
+
+            // Children come after their parents, so walking the nodes
+            // backwards merges every part after the parts it is made of.
+            for (size_t n = 0; n < nodes.size(); n++)
+            {
+                Part &part = _parts[nodes[n].part];
+                if (part.head[BY_LEFT] == part.tail[BY_LEFT])
+                    continue;
+
+                auto cut = find_cut(part);
+                if (!cut)
+                    return std::nullopt;
+
+                auto &[order, side] = *cut;
+                for (size_t i : side)
+                    unlink(part, i);
+                size_t rest = nodes[n].part;
+                size_t split = new_part(side);
+                bool side_first = forwards(order);
+
+                nodes[n].first = nodes.size();
+                nodes[n].second = nodes.size() + 1;
+                nodes[n].side_by_side = order == BY_LEFT || order == BY_RIGHT;
+                nodes.push_back({side_first ? split : rest, NONE, NONE, false});
+                nodes.push_back({side_first ? rest : split, NONE, NONE, false});
+            }
+
+            std::vector<std::optional<Rectangle>> merged(nodes.size());
+            for (size_t n = nodes.size(); n-- > 0;)
+            {
+                const Node &node = nodes[n];
+                if (node.first == NONE)
+                {
+                    merged[n] = rectangles[_parts[node.part].head[BY_LEFT]];
+                    continue;
+                }
+
+                const Rectangle &a = *merged[node.first], &b = *merged[node.second];
+                if (node.side_by_side)
+                {
+                    if (a.height() != b.height() || a.pos().y() != b.pos().y() ||
+                        int64_t(a.pos().x()) + a.width() != b.pos().x())
+                        return std::nullopt;
+                    merged[n] = merge_vertically(a, b);
+                }
+                else
+                {
+                    if (a.width() != b.width() || a.pos().x() != b.pos().x() ||
+                        int64_t(a.pos().y()) + a.height() != b.pos().y())
+                        return std::nullopt;
+                    merged[n] = merge_horizontally(a, b);
+                }
+            }
+            return merged[0];
+        }
+    };
+} // namespace
+
+std::optional<Rectangle> merge_all_unordered(const Rectangles &rectangles)
+{
+    return CutFinder(rectangles).merge(rectangles);
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 
 #include <cassert>
 #include <cinttypes>
+#include <cstddef>
+#include <initializer_list>
+#include <optional>
 #include <vector>
 
 class Position;
@@ -77,7 +80,7 @@ public:
 
     Position pos() const { return _pos; }
 
-    int32_t area() const { return _width * _height; }
+    int64_t area() const { return int64_t(_width) * _height; }
 
     Rectangle &operator=(const Rectangle &secondRectangle) = default;
 
@@ -88,24 +91,157 @@ public:
     Rectangle reflection() const;
 };
 
+class RectangleReference;
+
+// Rectangles are kept as a structure of arrays, one array per coordinate
+// and size, so that operations on the whole collection run over contiguous
+// int32_t arrays and vectorize. operator[] hands out RectangleReference
+// proxies, or copies for a const collection.
+//
+// Translating a collection only adds to its pending offset. The arrays
+// hold the positions less that offset, modulo 2^32, so reads add it back
+// and writes subtract it, and the offset never has to be folded in.
 class Rectangles
 {
 private:
-    std::vector<Rectangle> _rectangles;
+    std::vector<int32_t> _x, _y, _width, _height;
+    Vector _offset = Vector(0, 0);
+
+    friend class RectangleReference;
 
 public:
     Rectangles() = default;
-    Rectangles(std::initializer_list<Rectangle> rectangles) : _rectangles(rectangles) {}
+    Rectangles(std::initializer_list<Rectangle> rectangles);
 
-    size_t size() const { return _rectangles.size(); }
+    size_t size() const { return _x.size(); }
 
-    Rectangle &operator[](size_t i);
+    RectangleReference operator[](size_t i);
 
-    const Rectangle &operator[](size_t i) const;
+    const Rectangle operator[](size_t i) const;
 
     bool operator==(const Rectangles &rectangles);
 
     Rectangles &operator+=(const Vector &vector);
+
+    void push_back(const Rectangle &rectangle);
+
+    Rectangles reflection() const;
+
+    // Sum of the areas of the rectangles, overlaps counted as many times
+    // as they are covered.
+    int64_t area_sum() const;
+
+    // Area covered by at least one of the rectangles, area covered by at
+    // least two, and how many pairs of rectangles overlap. Rectangles are
+    // half-open, as in RectangleIndex, so ones which only touch do not
+    // overlap. A collection spans up to 3 * 2^31 along either axis, so an
+    // area may not fit in int64_t; such an area is given as INT64_MAX.
+    struct Coverage
+    {
+        int64_t union_area;
+        int64_t overlap_area;
+        int64_t overlapping_pairs;
+    };
+
+    // Computed with a sweep line over a segment tree, in O(n log n).
+    Coverage coverage() const;
+};
+
+class RectangleReference
+{
+private:
+    Rectangles &_rectangles;
+    size_t _i;
+
+public:
+    RectangleReference(Rectangles &rectangles, size_t i) : _rectangles(rectangles), _i(i) {}
+    RectangleReference(const RectangleReference &secondReference) = default;
+
+    int32_t width() const { return _rectangles._width[_i]; }
+
+    int32_t height() const { return _rectangles._height[_i]; }
+
+    Position pos() const;
+
+    int64_t area() const { return int64_t(width()) * height(); }
+
+    operator Rectangle() const { return Rectangle(width(), height(), pos()); }
+
+    // Assignments change the referenced rectangle, not the reference.
+    RectangleReference &operator=(const Rectangle &rectangle);
+
+    RectangleReference &operator=(const RectangleReference &secondReference);
+
+    bool operator==(const Rectangle &rectangle) const;
+
+    RectangleReference &operator+=(const Vector &vector);
+
+    Rectangle reflection() const;
+};
+
+// Spatial index over a collection of rectangles, answering which of them
+// contain a point or overlap a rectangle with their indices in the
+// collection. It is a packed R-tree bulk-loaded sort-tile-recursive: the
+// rectangles are cut into vertical slabs by x, each slab is sorted by y,
+// and every NODE_SIZE consecutive boxes get a parent, level by level up to
+// the root. Inserted rectangles wait in a short list which queries scan;
+// a full list becomes a tree of its own, merged with the smaller trees
+// built before it, so the index holds O(log n) trees of decreasing size.
+// Translating the index only moves its offset.
+//
+// Rectangles are half-open: they contain their left and lower edges but not
+// the right and upper ones, so tiles next to each other neither share
+// points nor overlap.
+class RectangleIndex
+{
+private:
+    struct Box
+    {
+        int64_t min_x, min_y, max_x, max_y;
+    };
+
+    struct Entry
+    {
+        Box box;
+        size_t id;
+    };
+
+    struct Tree
+    {
+        // Leaves in tree order; levels[0] holds their parents, and every
+        // further level the parents of the one before, up to the root.
+        std::vector<Entry> entries;
+        std::vector<std::vector<Box>> levels;
+
+        explicit Tree(std::vector<Entry> tree_entries);
+
+        void find(const Box &query, std::vector<size_t> &found) const;
+    };
+
+    std::vector<Tree> _trees;
+    std::vector<Entry> _pending;
+    size_t _size = 0;
+    int64_t _offset_x = 0, _offset_y = 0;
+
+    Box box_of(const Rectangle &rectangle) const;
+
+    std::vector<size_t> overlapping(const Box &query) const;
+
+public:
+    RectangleIndex() = default;
+    explicit RectangleIndex(const Rectangles &rectangles);
+
+    size_t size() const { return _size; }
+
+    // Returns the index of the rectangle, the next one in the collection.
+    size_t insert(const Rectangle &rectangle);
+
+    RectangleIndex &operator+=(const Vector &vector);
+
+    // Indices in increasing order.
+    std::vector<size_t> containing(const Position &position) const;
+
+    std::vector<size_t> overlapping(const Rectangle &rectangle) const;
 };
 
 Position operator+(const Position &position, const Vector &vector);
@@ -132,4 +268,18 @@ Rectangle merge_vertically(const Rectangle &rec1, const Rectangle &rec2);
 
 Rectangle merge_all(Rectangles rectangles);
 
+// Gives what merge_all gives, for rectangles in the same order, splitting
+// the work among threads; 0 uses one thread per hardware thread. The
+// result only depends on where each chunk of the order starts, which is
+// the extent of the rectangles before it, so the chunks are reduced to
+// their extents in parallel and then joined.
+Rectangle merge_all_parallel(const Rectangles &rectangles, unsigned threads = 0);
+
+// Merges rectangles given in any order which tile a rectangle, by cutting
+// it in two along a line no rectangle crosses, again and again. Returns
+// nothing when no sequence of merge_horizontally and merge_vertically
+// steps leads to one rectangle: when the rectangles overlap, leave gaps,
+// or tile in a way no straight cut splits, like a pinwheel.
+std::optional<Rectangle> merge_all_unordered(const Rectangles &rectangles);
+
 #endif //GEOMETRY_GEOMETRY_H
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "geometry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Benchmarks of whole-collection operations on Rectangles against the same
+// operations on a std::vector<Rectangle>, the layout Rectangles used to
+// have, of RectangleIndex queries against linear scans, and of merge_all
+// against merge_all_parallel. Every measurement is printed as one JSON
+// object per line.
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    bool quick = false;
+
+    struct Layouts
+    {
+        std::vector<Rectangle> aos;
+        Rectangles soa;
+    };
+
+    Layouts make_layouts(size_t count)
+    {
+        std::mt19937 random(42);
+        std::uniform_int_distribution<int32_t> coordinate(-1000000, 1000000);
+        std::uniform_int_distribution<int32_t> size(1, 1000);
+        Layouts layouts;
+
+        layouts.aos.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            Rectangle rectangle(size(random), size(random),
+                                Position(coordinate(random), coordinate(random)));
+            layouts.aos.push_back(rectangle);
+            layouts.soa.push_back(rectangle);
+        }
+        return layouts;
+    }
+
+    // Runs operation repeats times and reports the median.
+    template<typename Operation>
+    void measure(const char *benchmark, const char *layout, size_t count,
+                 size_t repeats, Operation operation)
+    {
+        std::vector<double> times;
+        for (size_t i = 0; i < repeats; i++)
+        {
+            auto begin = Clock::now();
+            operation();
+            times.push_back(std::chrono::duration<double, std::nano>(Clock::now() - begin).count());
+        }
+        std::sort(times.begin(), times.end());
+
+        double median = times[times.size() / 2];
+        std::printf("{\"benchmark\": \"%s\", \"layout\": \"%s\", \"rectangles\": %zu, "
+                    "\"median_ns\": %.0f, \"ns_per_rectangle\": %.3f}\n",
+                    benchmark, layout, count, median, median / count);
+        std::fflush(stdout);
+    }
+
+    // Keeps results alive so that the measured loops are not optimized out.
+    volatile int64_t sink;
+
+    // Runs count queries and reports their throughput and how many
+    // rectangles they found in total.
+    template<typename Query>
+    void measure_queries(const char *benchmark, const char *method, size_t rectangles,
+                         size_t count, Query query)
+    {
+        size_t found = 0;
+        auto begin = Clock::now();
+        for (size_t i = 0; i < count; i++)
+            found += query(i);
+        double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        std::printf("{\"benchmark\": \"%s\", \"method\": \"%s\", \"rectangles\": %zu, "
+                    "\"queries\": %zu, \"queries_per_sec\": %.0f, \"found\": %zu}\n",
+                    benchmark, method, rectangles, count, count / elapsed, found);
+        std::fflush(stdout);
+    }
+
+    bool contains(const Rectangle &rectangle, const Position &position)
+    {
+        return rectangle.pos().x() <= position.x() &&
+               position.x() - rectangle.pos().x() < rectangle.width() &&
+               rectangle.pos().y() <= position.y() &&
+               position.y() - rectangle.pos().y() < rectangle.height();
+    }
+
+    bool overlap(const Rectangle &a, const Rectangle &b)
+    {
+        return int64_t(a.pos().x()) < int64_t(b.pos().x()) + b.width() &&
+               int64_t(b.pos().x()) < int64_t(a.pos().x()) + a.width() &&
+               int64_t(a.pos().y()) < int64_t(b.pos().y()) + b.height() &&
+               int64_t(b.pos().y()) < int64_t(a.pos().y()) + a.height();
+    }
+
+    // Building a RectangleIndex, inserting into one, and point and overlap
+    // queries through it and by scanning the collection.
+    void bench_index(size_t count)
+    {
+        const Rectangles rectangles = make_layouts(count).soa;
+        size_t repeats = quick ? 3 : 5;
+        size_t queries = quick ? 1000 : 100000;
+        size_t scans = std::max<size_t>(10, std::min<size_t>(queries, 100000000 / count));
+        std::mt19937 random(7);
+        std::uniform_int_distribution<int32_t> coordinate(-1000000, 1000000);
+        std::vector<Position> points;
+        std::vector<Rectangle> windows;
+        for (size_t i = 0; i < queries; i++)
+        {
+            points.emplace_back(coordinate(random), coordinate(random));
+            windows.emplace_back(2000, 2000, Position(coordinate(random), coordinate(random)));
+        }
+
+        measure("index_build", "soa", count, repeats, [&]
+        {
+            RectangleIndex index(rectangles);
+            sink = index.size();
+        });
+        measure("index_insert", "soa", count, repeats, [&]
+        {
+            RectangleIndex index;
+            for (size_t i = 0; i < rectangles.size(); i++)
+                index.insert(rectangles[i]);
+            sink = index.size();
+        });
+
+        RectangleIndex index(rectangles);
+        measure_queries("point_query", "index", count, queries, [&](size_t i)
+        {
+            return index.containing(points[i]).size();
+        });
+        measure_queries("point_query", "scan", count, scans, [&](size_t i)
+        {
+            size_t found = 0;
+            for (size_t j = 0; j < rectangles.size(); j++)
+                found += contains(rectangles[j], points[i]);
+            return found;
+        });
+        measure_queries("overlap_query", "index", count, queries, [&](size_t i)
+        {
+            return index.overlapping(windows[i]).size();
+        });
+        measure_queries("overlap_query", "scan", count, scans, [&](size_t i)
+        {
+            size_t found = 0;
+            for (size_t j = 0; j < rectangles.size(); j++)
+                found += overlap(rectangles[j], windows[i]);
+            return found;
+        });
+    }
+
+    // merge_all against merge_all_parallel on a spiral tiling, in a valid
+    // merge order: strips alternately on the right and on top.
+    void bench_merge(size_t count)
+    {
+        Rectangles spiral{Rectangle(1, 1)};
+        Rectangle end = spiral[0];
+        for (size_t i = 1; i < count; i++)
+        {
+            Rectangle strip = i % 2 ? Rectangle(1 + i % 2, end.height(), end.pos() + Vector(end.width(), 0))
+                                    : Rectangle(end.width(), 1 + i % 2, end.pos() + Vector(0, end.height()));
+            spiral.push_back(strip);
+            end = Rectangle(end.width() + (i % 2 ? strip.width() : 0),
+                            end.height() + (i % 2 ? 0 : strip.height()), end.pos());
+        }
+        size_t repeats = quick ? 3 : 5;
+
+        measure("merge_all", "serial", count, repeats, [&]
+        {
+            sink = merge_all(spiral).width();
+        });
+        for (unsigned threads : {1, 2, 4, 8, 16})
+        {
+            char layout[32];
+            std::snprintf(layout, sizeof(layout), "threads_%u", threads);
+            measure("merge_all", layout, count, repeats, [&]
+            {
+                sink = merge_all_parallel(spiral, threads).width();
+            });
+        }
+    }
+
+    void bench(size_t count)
+    {
+        Layouts layouts = make_layouts(count);
+        size_t repeats = quick ? 3 : 11;
+        Vector offset(3, -7);
+
+        measure("translate", "aos", count, repeats, [&]
+        {
+            for (Rectangle &rectangle : layouts.aos)
+                rectangle += offset;
+        });
+        measure("translate", "soa", count, repeats, [&]
+        {
+            layouts.soa += offset;
+        });
+
+        measure("reflection", "aos", count, repeats, [&]
+        {
+            std::vector<Rectangle> reflected;
+            reflected.reserve(layouts.aos.size());
+            for (const Rectangle &rectangle : layouts.aos)
+                reflected.push_back(rectangle.reflection());
+            sink = reflected.back().width();
+        });
+        measure("reflection", "soa", count, repeats, [&]
+        {
+            Rectangles reflected = layouts.soa.reflection();
+            sink = reflected.size();
+        });
+
+        measure("area_sum", "aos", count, repeats, [&]
+        {
+            int64_t sum = 0;
+            for (const Rectangle &rectangle : layouts.aos)
+                sum += rectangle.area();
+            sink = sum;
+        });
+        measure("area_sum", "soa", count, repeats, [&]
+        {
+            sink = layouts.soa.area_sum();
+        });
+
+        measure("coverage", "soa", count, 3, [&]
+        {
+            sink = layouts.soa.coverage().union_area;
+        });
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t count : {1000, 100000, 1000000, 10000000})
+    {
+        if (quick && count > 100000)
+            break;
+        bench(count);
+        bench_index(count);
+        bench_merge(count);
+    }
+
+    return 0;
+}
\ No newline at end of file
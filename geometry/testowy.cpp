@@ -6,6 +6,7 @@
 #include <functional>
 #include <limits>
 #include <iostream>
+#include <random>
 
 #ifdef NDEBUG
 #undef NDEBUG
@@ -298,6 +299,7 @@ int main() {
 
     assert(rec7.area() == 300 * 400);
     assert(rec8.area() == 500 * 600);
+    assert(Rectangle(100000, 100000).area() == 10000000000);
 
     assert(rec7.reflection() == Rectangle(400, 300, {0, 0}));
     assert(rec8.reflection() == Rectangle(600, 500, {-39143, -2561}));
@@ -363,6 +365,123 @@ int main() {
 
     recs3 += Vector(1, 1);
 
+    // operator[] zwraca proxy, przez ktore zmienia sie prostokat w kolekcji.
+    assert(recs3[0] == rec102 + Vector(1, 1));
+    recs3[1] += Vector(-1, -1);
+    assert(recs3[1] == rec102);
+    recs3[2] = recs3[1];
+    assert(recs3[2] == rec102);
+    assert(recs3[2].area() == 26 * 31);
+
+    Rectangles recs11;
+    recs11.push_back(rec103);
+    assert(recs11.size() == 1);
+    assert(recs11.reflection()[0] == rec103.reflection());
+    assert(recs4.area_sum() == 3 * 5 + 26 * 31 + 591 * 411);
+
+    // Pokrycie: dwa kwadraty nachodza na siebie, trzeci prostokat tylko
+    // dotyka pierwszego, ale nachodzi na drugi.
+    Rectangles recs13{Rectangle(4, 4), Rectangle(4, 4, {2, 2}), Rectangle(2, 4, {4, 0})};
+    Rectangles::Coverage cov1 = recs13.coverage();
+    assert(cov1.union_area == 32);
+    assert(cov1.overlap_area == 8);
+    assert(cov1.overlapping_pairs == 2);
+    recs13 += Vector(-7, 11);
+    assert(recs13.coverage().union_area == 32);
+    recs13.push_back(Rectangle(1, 1, {-7, 11}));
+    assert(recs13.coverage().overlap_area == 8 + 1);
+    assert(recs13.coverage().overlapping_pairs == 2 + 1);
+
+    Rectangles::Coverage cov2 = Rectangles().coverage();
+    assert(cov2.union_area == 0 && cov2.overlap_area == 0 && cov2.overlapping_pairs == 0);
+
+    // Pola wieksze niz 2^32.
+    Rectangles recs14{Rectangle(2000000000, 2000000000, {-1000000000, -1000000000}),
+                      Rectangle(2000000000, 2000000000, {0, 0})};
+    assert(recs14.coverage().union_area == 7000000000000000000);
+    assert(recs14.coverage().overlap_area == 1000000000000000000);
+
+    // Pola na calym zakresie int32_t: dwa najwieksze kwadraty mieszcza sie
+    // w int64_t, trzy juz nie, wiec wynik to INT64_MAX.
+    const int32_t max32 = std::numeric_limits<int32_t>::max();
+    const int32_t min32 = std::numeric_limits<int32_t>::min();
+    Rectangles recs15{Rectangle(max32, max32, {min32, min32}), Rectangle(max32, max32, {0, 0})};
+    assert(recs15.coverage().union_area == 2 * (int64_t(max32) * max32));
+    recs15.push_back(Rectangle(max32, max32, {max32, min32}));
+    Rectangles::Coverage cov3 = recs15.coverage();
+    assert(cov3.union_area == std::numeric_limits<int64_t>::max());
+    assert(cov3.overlap_area == 0 && cov3.overlapping_pairs == 0);
+    recs15.push_back(Rectangle(max32, max32, {min32, min32}));
+    recs15.push_back(Rectangle(max32, max32, {0, 0}));
+    recs15.push_back(Rectangle(max32, max32, {max32, min32}));
+    assert(recs15.coverage().overlap_area == std::numeric_limits<int64_t>::max());
+
+    // Pokrycie malych losowych ukladow porownane z liczeniem pojedynczych
+    // pol siatki i sprawdzaniem kazdej pary prostokatow.
+    std::mt19937 rng(17);
+    for (int test = 0; test < 300; test++)
+    {
+        int count = rng() % 20, grid = 1 + rng() % 12;
+        std::vector<Rectangle> layout;
+        Rectangles recs16;
+        for (int i = 0; i < count; i++)
+        {
+            Rectangle rec(1 + rng() % grid, 1 + rng() % grid,
+                          {int32_t(rng() % (2 * grid)) - grid, int32_t(rng() % (2 * grid)) - grid});
+            layout.push_back(rec);
+            recs16.push_back(rec);
+        }
+        if (test % 2)
+        {
+            Vector shift(int32_t(rng() % 7) - 3, int32_t(rng() % 7) - 3);
+            recs16 += shift;
+            for (Rectangle &rec : layout)
+                rec += shift;
+        }
+
+        auto inside = [](const Rectangle &rec, int32_t x, int32_t y) {
+            return rec.pos().x() <= x && x < rec.pos().x() + rec.width() &&
+                   rec.pos().y() <= y && y < rec.pos().y() + rec.height();
+        };
+        Rectangles::Coverage expected{0, 0, 0};
+        for (int32_t x = -grid - 3; x < 2 * grid + 3; x++)
+            for (int32_t y = -grid - 3; y < 2 * grid + 3; y++)
+            {
+                auto covering = std::count_if(layout.begin(), layout.end(),
+                                              [&](const Rectangle &rec) { return inside(rec, x, y); });
+                expected.union_area += covering >= 1;
+                expected.overlap_area += covering >= 2;
+            }
+        for (int i = 0; i < count; i++)
+            for (int j = i + 1; j < count; j++)
+            {
+                const Rectangle &a = layout[i], &b = layout[j];
+                expected.overlapping_pairs += a.pos().x() < b.pos().x() + b.width() &&
+                                              b.pos().x() < a.pos().x() + a.width() &&
+                                              a.pos().y() < b.pos().y() + b.height() &&
+                                              b.pos().y() < a.pos().y() + a.height();
+            }
+
+        Rectangles::Coverage cov4 = recs16.coverage();
+        assert(cov4.union_area == expected.union_area);
+        assert(cov4.overlap_area == expected.overlap_area);
+        assert(cov4.overlapping_pairs == expected.overlapping_pairs);
+    }
+
+    // Przesuniecia kolekcji skladaja sie, zanim ktokolwiek odczyta prostokaty.
+    Rectangles recs12{rec101, rec102};
+    recs12 += Vector(5, -3);
+    recs12 += Vector(-2, 7);
+    recs12.push_back(rec103);
+    recs12[1] = rec101;
+    assert(recs12[0] == rec101 + Vector(3, 4));
+    assert(recs12[1] == rec101);
+    assert(recs12[2] == rec103);
+    assert(recs12 == (Rectangles{rec101 + Vector(3, 4), rec101, rec103}));
+    assert(recs12.reflection()[0] == (rec101 + Vector(3, 4)).reflection());
+    assert(recs12 + Vector(-3, -4) + Vector(0, 0) ==
+           (Rectangles{rec101, rec101 + Vector(-3, -4), rec103 + Vector(-3, -4)}));
+
     // Przenoszenie i kopiowanie
 
     // Konstruktor kopiujacy.
@@ -381,6 +500,20 @@ int main() {
     Rectangles recs10{rec101};
     recs10 = std::move(recs9);
 
+    // Indeks przestrzenny zwraca numery prostokatow w kolekcji.
+    Rectangles tiles{Rectangle(2, 2), Rectangle(2, 2, {2, 0}), Rectangle(4, 1, {0, 2})};
+    RectangleIndex index(tiles);
+    assert(index.size() == 3);
+    assert(index.containing({1, 1}) == std::vector<size_t>{0});
+    assert(index.containing({2, 1}) == std::vector<size_t>{1});
+    assert(index.containing({4, 1}).empty());
+    assert((index.overlapping(Rectangle(2, 2, {1, 1})) == std::vector<size_t>{0, 1, 2}));
+    assert(index.insert(Rectangle(1, 1, {1, 1})) == 3);
+    assert((index.containing({1, 1}) == std::vector<size_t>{0, 3}));
+    index += Vector(10, 0);
+    assert(index.containing({1, 1}).empty());
+    assert((index.containing({11, 1}) == std::vector<size_t>{0, 3}));
+
 // ------------ VARIOUS ---------------
 
     // Dodawanie
@@ -476,6 +609,60 @@ int main() {
 
     assert(ret_all_1 == Rectangle(6, 5));
 
+    // merge_all_parallel daje to samo co merge_all.
+    assert(merge_all_parallel({Rectangle(2, 1),
+                               Rectangle(2, 1, {0, 1}),
+                               Rectangle(2, 2, {2, 0}),
+                               Rectangle(4, 2, {0, 2}),
+                               Rectangle(2, 4, {4, 0}),
+                               Rectangle(6, 1, {0, 4})}, 4) == Rectangle(6, 5));
+
+    // Spirala: na zmiane pasek z prawej i pasek u gory, dosc dluga, zeby
+    // podzielic ja miedzy watki.
+    Rectangles spiral{Rectangle(1, 1, {-7, 3})};
+    Rectangle spiral_end = spiral[0];
+    for (int i = 1; i < 100000; i++)
+    {
+        Rectangle strip = i % 2 ? Rectangle(1 + i % 3, spiral_end.height(),
+                                            spiral_end.pos() + Vector(spiral_end.width(), 0))
+                                : Rectangle(spiral_end.width(), 1 + i % 5,
+                                            spiral_end.pos() + Vector(0, spiral_end.height()));
+        spiral.push_back(strip);
+        spiral_end = i % 2 ? merge_vertically(spiral_end, strip) : merge_horizontally(spiral_end, strip);
+    }
+    assert(merge_all(spiral) == spiral_end);
+    for (unsigned threads : {0, 1, 2, 3, 8})
+        assert(merge_all_parallel(spiral, threads) == spiral_end);
+
+    // merge_all_unordered: te same prostokaty w dowolnej kolejnosci.
+    assert(merge_all_unordered({Rectangle(6, 1, {0, 4}),
+                                Rectangle(2, 4, {4, 0}),
+                                Rectangle(2, 1, {0, 1}),
+                                Rectangle(4, 2, {0, 2}),
+                                Rectangle(2, 2, {2, 0}),
+                                Rectangle(2, 1)}) == Rectangle(6, 5));
+    assert(merge_all_unordered({mr2, mr1}) == Rectangle(4, 6, {3, 7}));
+    assert(merge_all_unordered({mr9}) == mr9);
+
+    // Dwa kafelki 1x1 maja wspolna krawedz, ale ich polaczenie nie
+    // prowadzi do celu: trzeba najpierw rozciac wzdluz x = 1.
+    assert(merge_all_unordered({Rectangle(1, 4),
+                                Rectangle(1, 3, {1, 1}),
+                                Rectangle(1, 1, {0, 4}),
+                                Rectangle(1, 1, {1, 4}),
+                                Rectangle(1, 4, {2, 1}),
+                                Rectangle(2, 1, {1, 0})}) == Rectangle(3, 5));
+
+    // Wiatraczek, dziura, nachodzenie i pusty zbior.
+    assert(!merge_all_unordered({Rectangle(2, 1),
+                                 Rectangle(1, 2, {2, 0}),
+                                 Rectangle(2, 1, {1, 2}),
+                                 Rectangle(1, 2, {0, 1}),
+                                 Rectangle(1, 1, {1, 1})}));
+    assert(!merge_all_unordered({Rectangle(2, 1), Rectangle(2, 1, {0, 2})}));
+    assert(!merge_all_unordered({Rectangle(2, 1), Rectangle(1, 1, {1, 0}), Rectangle(1, 1, {2, 0})}));
+    assert(!merge_all_unordered(Rectangles()));
+
     // Czy typ zwracany przez origin() zawiera consta.
     assert(std::is_const_v<std::remove_reference_t<decltype(Position::origin())>>);
 